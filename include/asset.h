@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * A pre-rasterised image, stored in flash as run length encoded RGB565. Each
+ * run holds a palette index in its top bit and a pixel count in the rest, and
+ * runs fill the image left to right, top to bottom.
+ *
+ * Assets are generated at build time by tools/build_assets.py.
+ */
+class Asset {
+	public:
+		int16_t x, y;
+		uint16_t width, height;
+		uint16_t palette[2];
+		const uint16_t *runs;
+		uint32_t num_runs;
+};
+
+#define ASSET_RUN_INDEX(run) ((run) >> 15)
+#define ASSET_RUN_LENGTH(run) ((run) & 0x7FFF)
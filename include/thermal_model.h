@@ -0,0 +1,224 @@
+#pragma once
+
+/**
+ * A simple model of the oven. The elements add heat at a fixed rate, the
+ * chamber loses heat to the room in proportion to how much hotter it is, and
+ * switching the elements only takes effect after a dead time.
+ *
+ * This has no hardware dependencies, so the firmware and the host tools share
+ * it.
+ */
+class ThermalModel {
+	public:
+		// Degrees per second gained with the elements on, at ambient.
+		float heat_rate = 1.5;
+		// Fraction of the difference to ambient lost per second.
+		float loss_rate = 0.007;
+		float ambient = 25;
+		// How long after switching on/off the temperature responds.
+		unsigned long heat_lag_time = 10'000;
+		unsigned long cool_lag_time = 20'000;
+
+		/**
+		 * Builds a model from the firmware's calibration. Calibration stops
+		 * heating at 240C and records how far the temperature kept climbing
+		 * before it turned, which tells us the net heating rate up there.
+		 */
+		static ThermalModel from_calibration(
+				unsigned long cool_lag_time,
+				unsigned long heat_lag_time,
+				int lag_degrees,
+				float loss_rate=0.007,
+				float ambient=25) {
+			ThermalModel model;
+			model.loss_rate = loss_rate;
+			model.ambient = ambient;
+			model.heat_lag_time = heat_lag_time;
+			model.cool_lag_time = cool_lag_time;
+			if (cool_lag_time > 0 && lag_degrees > 0) {
+				float rate_at_240 = lag_degrees / (cool_lag_time / 1000.0f);
+				model.heat_rate = rate_at_240 + loss_rate * (240 - ambient);
+			}
+			return model;
+		}
+
+		/**
+		 * Rate of change of temperature, in degrees per second, with the
+		 * elements effectively on or off.
+		 */
+		float get_rate(float temp, bool heating) const {
+			float rate = -loss_rate * (temp - ambient);
+			if (heating) rate += heat_rate;
+			return rate;
+		}
+
+		/**
+		 * Hottest the oven can get with the elements held on.
+		 */
+		float get_max_temp() const {
+			return ambient + heat_rate / loss_rate;
+		}
+};
+
+/**
+ * Steps a ThermalModel forwards in time, tracking the dead time between the
+ * elements being switched and the chamber responding.
+ */
+class ThermalSimulation {
+	public:
+		ThermalModel model;
+		float temp;
+		unsigned long time = 0;
+
+		ThermalSimulation(const ThermalModel& model, float start_temp)
+			: model(model), temp(start_temp) {}
+
+		void step(unsigned long dt, bool elements_on) {
+			if (elements_on != commanded) {
+				commanded = elements_on;
+				switch_time = time + (elements_on ? model.heat_lag_time : model.cool_lag_time);
+			}
+			if (heating != commanded && time >= switch_time) {
+				heating = commanded;
+			}
+
+			temp += model.get_rate(temp, heating) * (dt / 1000.0f);
+			time += dt;
+		}
+
+	private:
+		bool commanded = false;
+		bool heating = false;
+		unsigned long switch_time = 0;
+};
+
+/**
+ * Refines a ThermalModel's heating and loss rates from a bake's temperature
+ * readings, by recursive least squares. The dead times are left as
+ * calibrated.
+ *
+ * Readings are gathered into windows long enough to see past the sensor's
+ * quantisation, and each window fits the rate of change against how much of
+ * it the elements were effectively heating and how far above ambient the
+ * oven was. That is a fixed amount of work per reading and per window.
+ */
+class ThermalEstimator {
+	public:
+		ThermalModel model;
+		int updates = 0;
+
+		unsigned long window_time = 5'000;
+		// How quickly older windows are forgotten, per window.
+		float forgetting = 0.99;
+		// Variance of a window's measured rate, in (degrees per second)^2.
+		float rate_variance = 0.01;
+		// Estimates are kept within these multiples of the reference model.
+		float min_scale = 0.5;
+		float max_scale = 2;
+		// Windows needed before the estimate is worth keeping.
+		int min_updates = 20;
+
+		/**
+		 * Starts from prior, with about as much confidence as a handful of
+		 * windows. Bounds are taken relative to reference, which should be
+		 * the oven's calibration, so that the estimate can't drift away
+		 * from it across many bakes.
+		 */
+		void begin(const ThermalModel& prior, const ThermalModel& reference) {
+			model = prior;
+			heat_low = reference.heat_rate * min_scale;
+			heat_high = reference.heat_rate * max_scale;
+			loss_low = reference.loss_rate * min_scale;
+			loss_high = reference.loss_rate * max_scale;
+
+			float heat_spread = reference.heat_rate * 0.25f;
+			float loss_spread = reference.loss_rate * 0.25f;
+			p[0][0] = heat_spread * heat_spread / rate_variance;
+			p[1][1] = loss_spread * loss_spread / rate_variance;
+			p[0][1] = p[1][0] = 0;
+
+			updates = 0;
+			started = false;
+		}
+
+		void add_sample(unsigned long time, float temp, bool elements_on) {
+			if (!started) {
+				started = true;
+				commanded = heating = elements_on;
+				window_start = last_time = time;
+				window_start_temp = temp;
+				heating_time = excess_time = 0;
+				return;
+			}
+
+			// Mirror ThermalSimulation's dead time to know when the
+			// elements were actually putting heat in.
+			if (elements_on != commanded) {
+				commanded = elements_on;
+				switch_time = time + (elements_on ? model.heat_lag_time : model.cool_lag_time);
+			}
+			if (heating != commanded && time >= switch_time) {
+				heating = commanded;
+			}
+
+			float dt = (time - last_time) / 1000.0f;
+			last_time = time;
+			if (heating) heating_time += dt;
+			excess_time += (temp - model.ambient) * dt;
+
+			if (time - window_start >= window_time) {
+				float span = (time - window_start) / 1000.0f;
+				update(heating_time / span, excess_time / span, (temp - window_start_temp) / span);
+				window_start = time;
+				window_start_temp = temp;
+				heating_time = excess_time = 0;
+			}
+		}
+
+		bool is_converged() const {
+			return updates >= min_updates;
+		}
+
+	private:
+		float p[2][2];
+		float heat_low, heat_high, loss_low, loss_high;
+
+		bool started = false;
+		bool commanded = false;
+		bool heating = false;
+		unsigned long switch_time = 0;
+		unsigned long last_time = 0;
+		unsigned long window_start = 0;
+		float window_start_temp = 0;
+		float heating_time = 0;
+		float excess_time = 0;
+
+		/**
+		 * One least squares step for rate = heat_rate * heating
+		 * - loss_rate * excess.
+		 */
+		void update(float heating_fraction, float excess, float rate) {
+			float phi[2] = { heating_fraction, -excess };
+			float p_phi[2] = {
+				p[0][0] * phi[0] + p[0][1] * phi[1],
+				p[1][0] * phi[0] + p[1][1] * phi[1],
+			};
+			float gain_denominator = forgetting + phi[0] * p_phi[0] + phi[1] * p_phi[1];
+			float gain[2] = { p_phi[0] / gain_denominator, p_phi[1] / gain_denominator };
+
+			float error = rate - (model.heat_rate * phi[0] + model.loss_rate * phi[1]);
+			model.heat_rate = clamp(model.heat_rate + gain[0] * error, heat_low, heat_high);
+			model.loss_rate = clamp(model.loss_rate + gain[1] * error, loss_low, loss_high);
+
+			for (int i = 0; i < 2; i++) {
+				for (int j = 0; j < 2; j++) {
+					p[i][j] = (p[i][j] - gain[i] * p_phi[j]) / forgetting;
+				}
+			}
+			updates++;
+		}
+
+		static float clamp(float value, float low, float high) {
+			return value < low ? low : value > high ? high : value;
+		}
+};
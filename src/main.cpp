@@ -5,14 +5,17 @@
 #include <SPI.h>
 #include <LittleFS.h>
 
-#include <sstream>
 #include <string>
-#include <iostream>
-#include <iomanip>
 
-#include <Fonts/FreeSerif18pt7b.h>
+#include <asset.h>
+#include <assets.h>
+#include <thermal_model.h>
 
 #include <pico/util/queue.h>
+#include <pico/time.h>
+#include <hardware/flash.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 
 #define DISPLAY_CS (17)
 #define DISPLAY_DC (16)
@@ -22,7 +25,24 @@
 
 #define TEMP_DO (27)
 #define TEMP_CS (26)
+#define TEMP_BOARD_CS (21)
 #define TEMP_CLK (22)
+// A board probe needs a second MAX31855 on TEMP_BOARD_CS, so it is opt in:
+// build with -DNUM_THERMOCOUPLES=2 when one is fitted.
+#ifndef NUM_THERMOCOUPLES
+#define NUM_THERMOCOUPLES (1)
+#endif
+// The board lags behind the air. If set, the air reading is passed through a
+// first order lag with this time constant to estimate the board temperature.
+// Off unless built with -DAIR_TO_BOARD_LAG_MS=..., as the right value depends
+// on the oven and the boards in it.
+#ifndef AIR_TO_BOARD_LAG_MS
+#define AIR_TO_BOARD_LAG_MS (0)
+#endif
+#define BOARD_PROBE_WEIGHT (3)
+#define PROBE_MAX_DISAGREEMENT (60)
+#define SENSOR_INTERNAL_MIN (-20)
+#define SENSOR_INTERNAL_MAX (85)
 
 #define BUTTON_TOP_LEFT (12)
 #define BUTTON_TOP_RIGHT (14)
@@ -39,15 +59,66 @@
 #define BOTTOM_ELEMENT (10)
 
 #define HEADER_FOOTER_SIZE (12)
+#define FRAME_MS (50)
 #define TEMPERATURE_WARM (50)
 #define TEMPERATURE_HOT (85)
 
+#define DRAW_TEXT_MAX (32)
+
+#define SETTINGS_MAGIC (0x4E45564F)
+#define SETTINGS_VERSION (2)
+// Refined rates are only written back once either has moved by more than
+// this fraction, so that steady bakes don't wear the flash.
+#define MODEL_SAVE_CHANGE (0.02)
+#define BOOT_TARGET_MS (400)
+
+#define MAX_BATCH_RUNS (20)
+
+#define TICK_MS (100)
+#define IDLE_TICK_MS (500)
+#define BUTTON_SAMPLE_MS (5)
+#define BUTTON_DEBOUNCE_MASK (0x0F)
+#define BUTTON_LONG_PRESS_MS (1000)
+#define BUTTON_REPEAT_DELAY_MS (400)
+#define BUTTON_REPEAT_START_MS (200)
+#define BUTTON_REPEAT_MIN_MS (40)
+#define INPUT_QUEUE_SIZE (16)
+
+#define SUPERVISOR_PERIOD_MS (10)
+#define SUPERVISOR_IDLE_PERIOD_MS (100)
+#define SUPERVISOR_ALARM (2)
+#define SAFETY_MAX_TEMP (290)
+#define SAFETY_STALE_MS (1000)
+#define SAFETY_RISE_WINDOW_MS (60'000)
+#define SAFETY_MIN_RISE (5)
+#define WATCHDOG_TIMEOUT_MS (2000)
+
+#define COOL_DONE_TEMP (150)
+#define COOL_MAX_SLOPE (4)
+#define COOL_RATE_WINDOW_MS (5'000)
+#define COOL_PREDICT_STEP_MS (1000)
+#define DOOR_LOSS_FACTOR (4)
+#define BUZZER_FREQUENCY (2'000)
+#define BUZZER_BEEP_MS (200)
+#define BUZZER_BEEPS (3)
+
+#define BACKLIGHT_FULL (255)
+#define BACKLIGHT_DIM (12)
+#define BACKLIGHT_DIM_MS (60'000)
+
 using std::string;
-using std::ostringstream;
 
 // ** GLOBALS ** //
 
-Adafruit_MAX31855 thermocouple(TEMP_CLK, TEMP_CS, TEMP_DO);
+// All thermocouples share the clock and data lines, with a chip select each.
+// The first measures the air, and the rest are probes on the board.
+static_assert(NUM_THERMOCOUPLES >= 1 && NUM_THERMOCOUPLES <= 2, "Only TEMP_CS and TEMP_BOARD_CS are wired");
+Adafruit_MAX31855 thermocouples[NUM_THERMOCOUPLES] = {
+	Adafruit_MAX31855(TEMP_CLK, TEMP_CS, TEMP_DO),
+#if NUM_THERMOCOUPLES > 1
+	Adafruit_MAX31855(TEMP_CLK, TEMP_BOARD_CS, TEMP_DO),
+#endif
+};
 
 class NoArgsType {};
 class RectType {
@@ -86,9 +157,21 @@ class PixelType {
 		uint16_t x,y;
 		uint16_t color;
 };
+class MarkType {
+	public:
+		int index;
+};
+class BlitType {
+	public:
+		const Asset *asset;
+};
+class ScreenType {
+	public:
+		int state;
+};
 class DrawMessage {
 	public:
-		enum { CLEAR,RECT,TEXT,CURSOR,PRINT,CONFIG,LINE,PIXEL } type;
+		enum { CLEAR,RECT,TEXT,CURSOR,PRINT,CONFIG,LINE,PIXEL,MARK,BLIT,SCREEN } type;
 		union {
 			NoArgsType nothing;
 			RectType rect;
@@ -97,16 +180,47 @@ class DrawMessage {
 			ConfigType config;
 			LineType line;
 			PixelType pixel;
+			MarkType mark;
+			BlitType blit;
+			ScreenType screen;
 		};
-		// Delcared separately due to containing a string.
-		string *str = nullptr;
+		// Text is carried inline so that sending a message never touches the
+		// heap. Longer prints are split across several messages.
+		char str[DRAW_TEXT_MAX] = "";
 };
 
 
 queue_t drawing_queue;
 
-// Drawing
-uint16_t text_bg_color = 0x0000;
+// Boot timeline
+enum BootMark {
+	BOOT_START,
+	BOOT_SETTINGS_LOADED,
+	BOOT_SENSOR_READY,
+	BOOT_DISPLAY_READY,
+	BOOT_FIRST_SCREEN,
+	NUM_BOOT_MARKS
+};
+volatile unsigned long boot_marks[NUM_BOOT_MARKS] = {0};
+bool boot_reported = false;
+
+// Settings, stored in the flash sector reserved for EEPROM emulation. It's
+// memory mapped, so it can be validated and read in place without mounting
+// a filesystem.
+class SettingsRecord {
+	public:
+		uint32_t magic;
+		uint32_t version;
+		uint32_t cool_lag_time;
+		uint32_t heat_lag_time;
+		int32_t lag_degrees;
+		// Refined by ThermalEstimator across bakes, or zero if not yet.
+		float heat_rate;
+		float loss_rate;
+		uint32_t crc;
+};
+extern "C" uint8_t _EEPROM_start[];
+bool settings_need_flash = false;
 
 // State machine
 enum State {
@@ -117,7 +231,10 @@ enum State {
 	PICK_PROFILE,
 	BAKE,
 	FINISHED_BAKE,
-	FINISHED_CALIBRATE
+	FINISHED_CALIBRATE,
+	BATCH_IDLE,
+	FAULT,
+	NUM_STATES
 };
 State current_state = MAIN_MENU;
 State next_state = MAIN_MENU;
@@ -125,11 +242,22 @@ State next_state = MAIN_MENU;
 // Temperature
 int current_temp = -1;
 int last_temp = -1;
-uint16_t current_temp_color = 0x0000;
+// The hottest healthy channel, unfused, for the supervisor's limit. The
+// fused reading follows the board, and the air can be well above it.
+volatile int hottest_temp = -1;
+
+// Sensor fusion. Board probes are what we actually care about, so they are
+// trusted over the air, by BOARD_PROBE_WEIGHT. Faulty, missing or implausible
+// probes are left out.
+double thermocouple_readings[NUM_THERMOCOUPLES];
+uint8_t thermocouple_faults[NUM_THERMOCOUPLES];
+// Whether a working MAX31855 has answered on each channel yet.
+bool thermocouple_present[NUM_THERMOCOUPLES] = {false};
+double air_board_estimate = NAN;
+unsigned long last_fusion_time = 0;
 
 // Calibration
 bool is_calibrated = false;
-unsigned long last_drawn_time = 0;
 unsigned long calibrate_1_start_time = 0;
 unsigned long calibrate_2_start_time = 0;
 unsigned long calibrate_3_start_time = 0;
@@ -137,6 +265,12 @@ unsigned long calibration_cool_lag_time = -1;
 unsigned long calibration_heat_lag_time = -1;
 int calibration_lag_degrees = -1;
 
+// Refinements to the calibrated model, learnt from each bake.
+bool model_adapted = false;
+float model_heat_rate = 0;
+float model_loss_rate = 0;
+ThermalEstimator estimator;
+
 // Baking
 enum ReflowState {
 	PREHEAT,
@@ -154,17 +288,120 @@ int reflow_temp = 249;
 int reflow_duration = 60'000;
 int cool_duration = 35'000;
 
+// Where the soak ramp starts from. Normally the preheat temperature, but a
+// warm oven starts soaking from wherever it already is.
+int soak_start_temp = 150;
+
 int holding_at_temp = 0;
 int holding_at_time = 0;
 int holding_at_reheat_time = 0;
 int desired_temp = 0;
 unsigned long reflow_state_start_time = 0;
 
+// Batch production
+int batch_runs = 1;
+int batch_runs_done = 0;
+int batch_warm_margin = 10;
+unsigned long batch_start_time = 0;
+unsigned long run_start_time = 0;
+unsigned long last_cycle_time = 0;
+
+// Cooling assist. Opening the door speeds up cooling, but opened too early
+// the board cools faster than the paste allows. Times are from the start of
+// COOL.
+bool cooling_assist_active = false;
+// Learnt from previous bakes, or zero to guess from the closed door loss.
+float door_loss_rate = 0;
+unsigned long door_prompt_time = 0;
+unsigned long predicted_cool_time = 0;
+bool door_prompted = false;
+int door_beeps = 0;
+unsigned long cool_rate_window_time = 0;
+int cool_rate_window_temp = 0;
+float max_cool_rate = 0;
+float door_loss_total = 0;
+int door_loss_samples = 0;
+long last_cool_saving = 0;
+enum CoolingStatus {
+	COOLING_NONE,
+	COOLING_COUNTDOWN,
+	COOLING_OPEN_NOW,
+	COOLING_DOOR_OPEN,
+	COOLING_TOO_FAST
+};
+CoolingStatus cooling_status = COOLING_NONE;
+
+// What the screen should show. Core 0 publishes a snapshot every pass of
+// loop(), and core 1 lays it out and draws it at its own frame rate. It is
+// shared through a seqlock: the sequence is odd whilst a write is under way,
+// and a reader that sees it change retries, so core 0 never waits on core 1.
+class OvenSnapshot {
+	public:
+		State state;
+		ReflowState reflow_state;
+		int16_t temp;
+		int16_t last_temp;
+		// Where the bake should be right now, or -1 outside of a bake.
+		int16_t setpoint;
+		// One bit per faulty thermocouple.
+		uint8_t faults;
+		uint8_t selection;
+		CoolingStatus cooling;
+		uint32_t state_time;
+		uint32_t door_countdown;
+};
+volatile uint32_t snapshot_sequence = 0;
+OvenSnapshot snapshot;
+
 // Menus
-int last_drawn_selection = -1;
 int selection = 0;
 int num_items = 0;
 
+// Input. Buttons are sampled from a timer interrupt, which pushes events onto
+// a ring buffer for loop() to handle. There is one producer and one consumer
+// on the same core, so the indices alone keep it consistent.
+enum Button {
+	TOP_LEFT,
+	TOP_RIGHT,
+	BOTTOM_LEFT,
+	BOTTOM_RIGHT,
+	NUM_BUTTONS
+};
+enum InputEventType {
+	PRESS,
+	LONG_PRESS,
+	REPEAT,
+	NUM_INPUT_EVENTS
+};
+class ButtonState {
+	public:
+		int pin;
+		uint8_t history;
+		bool pressed;
+		unsigned long held_time;
+		unsigned long next_repeat_time;
+		unsigned long repeat_interval;
+};
+ButtonState buttons[NUM_BUTTONS] = {
+	{ BUTTON_TOP_LEFT },
+	{ BUTTON_TOP_RIGHT },
+	{ BUTTON_BOTTOM_LEFT },
+	{ BUTTON_BOTTOM_RIGHT },
+};
+repeating_timer_t button_timer;
+volatile bool button_timer_running = false;
+volatile uint8_t input_events[INPUT_QUEUE_SIZE];
+volatile uint8_t input_head = 0;
+volatile uint8_t input_tail = 0;
+unsigned long last_tick_time = 0;
+
+// Idle. States that are only waiting on the operator tick slowly, and the
+// backlight dims if nobody touches the buttons for a while.
+unsigned long last_input_time = 0;
+bool backlight_dimmed = false;
+unsigned long state_start_time = 0;
+uint64_t state_sleep_us = 0;
+
 // ** UTIL FUNCTIONS ** //
 
 void send_clear() {
@@ -172,7 +409,7 @@ void send_clear() {
 	queue_add_blocking(&drawing_queue, &msg);
 }
 
-void send_text(string text, int x, int y, Justification j, uint16_t fg=0xFFFF, uint16_t bg=0x0000) {
+void send_text(const string& text, int x, int y, Justification j, uint16_t fg=0xFFFF, uint16_t bg=0x0000) {
 	DrawMessage msg{
 		DrawMessage::TEXT,
 		{
@@ -181,9 +418,11 @@ void send_text(string text, int x, int y, Justification j, uint16_t fg=0xFFFF, u
 				fg, bg,
 				j,
 			}
-		},
-		new string(text)
+		}
 	};
+	// Justified text must arrive in one piece, so anything too long is
+	// truncated.
+	strncpy(msg.str, text.c_str(), DRAW_TEXT_MAX - 1);
 	queue_add_blocking(&drawing_queue, &msg);
 }
 
@@ -211,7 +450,7 @@ void send_rect(int x, int y, int w, int h, uint16_t color) {
 	queue_add_blocking(&drawing_queue, &msg);
 }
 
-void send_print(string text, int x=-1, int y=-1) {
+void send_print(const string& text, int x=-1, int y=-1) {
 	if (x != -1 && y != -1) {
 		DrawMessage msg{
 			DrawMessage::CURSOR,
@@ -222,12 +461,13 @@ void send_print(string text, int x=-1, int y=-1) {
 		queue_add_blocking(&drawing_queue, &msg);
 	}
 
-	DrawMessage msg{
-		DrawMessage::PRINT,
-		{ NoArgsType{} },
-		new string(text)
-	};
-	queue_add_blocking(&drawing_queue, &msg);
+	// Printing carries on from the cursor, so long strings can safely be sent
+	// in chunks.
+	for (size_t offset = 0; offset < text.size(); offset += DRAW_TEXT_MAX - 1) {
+		DrawMessage msg{ DrawMessage::PRINT, { NoArgsType{} } };
+		text.copy(msg.str, DRAW_TEXT_MAX - 1, offset);
+		queue_add_blocking(&drawing_queue, &msg);
+	}
 }
 
 void send_line(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color) {
@@ -250,171 +490,237 @@ void send_pixel(uint16_t x, uint16_t y, uint16_t color) {
 	queue_add_blocking(&drawing_queue, &msg);
 }
 
-string get_time_string(unsigned long millis) {
-	ostringstream str;
-	str << std::setfill('0') << std::setw(2) << millis / 1000 / 60;
-	str << ":";
-	str << std::setfill('0') << std::setw(2) << millis / 1000 % 60;
-	return str.str();
+void send_mark(BootMark index) {
+	DrawMessage msg{
+		DrawMessage::MARK,
+		{
+			.mark=MarkType{index}
+		}
+	};
+	queue_add_blocking(&drawing_queue, &msg);
 }
 
-void draw_temperature() {
-	string temp_sign = "";
-	if (current_temp != -1 && last_temp != -1) {
-		if (current_temp > last_temp) temp_sign = "+++";
-		if (current_temp < last_temp) temp_sign = "---";
-	}
+void send_blit(const Asset *asset) {
+	DrawMessage msg{
+		DrawMessage::BLIT,
+		{
+			.blit=BlitType{asset}
+		}
+	};
+	queue_add_blocking(&drawing_queue, &msg);
+}
 
-	ostringstream temp_string;
-	temp_string << "TEMP: ";
-	if (current_temp == -1) temp_string << "???";
-	else temp_string << current_temp;
-	temp_string << "C " << temp_sign;
-	string text = temp_string.str();
+/**
+ * Tells core 1 that the new screen for state is fully queued, so it can
+ * start drawing snapshots over it.
+ */
+void send_screen(State state) {
+	DrawMessage msg{
+		DrawMessage::SCREEN,
+		{
+			.screen=ScreenType{state}
+		}
+	};
+	queue_add_blocking(&drawing_queue, &msg);
+}
 
-	int x = (320 / 2);
-	int y = 240 - HEADER_FOOTER_SIZE + 2;
+void boot_mark(BootMark index) {
+	boot_marks[index] = millis();
+}
 
-	send_config();
-	send_text(text, x, y, CENTER, 0xFFFF, current_temp_color);
+uint32_t crc32(const void *data, size_t length) {
+	const uint8_t *bytes = (const uint8_t *) data;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; i++) {
+		crc ^= bytes[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
 }
 
-void draw_header() {
-	uint16_t color_fg = ST77XX_WHITE;
-	uint16_t color_bg = current_temp_color;
-	text_bg_color = color_bg;
+/**
+ * Writes millis as mm:ss into str. Core 1 draws times every frame, so it
+ * formats into its own buffers rather than building strings. Stops at 99:59
+ * so that it always fits.
+ */
+void format_time(char *str, size_t size, unsigned long millis) {
+	unsigned long seconds = millis / 1000;
+	if (seconds > 99 * 60 + 59) seconds = 99 * 60 + 59;
+	snprintf(str, size, "%02lu:%02lu", seconds / 60, seconds % 60);
+}
 
-	send_rect(0, 0, 320, HEADER_FOOTER_SIZE, color_bg);
-	send_config();
+string get_time_string(unsigned long millis) {
+	char str[16];
+	format_time(str, sizeof(str), millis);
+	return str;
+}
 
-	string l_action = "";
-	switch (current_state) {
-		case MAIN_MENU:
-		case PICK_PROFILE:
-			l_action = "PICK";
-			break;
-		case FINISHED_BAKE:
-		case FINISHED_CALIBRATE:
-			l_action = "DONE";
-			break;
-		default:
-			break;
-	}
-	send_text(l_action, 0, 2, LEFT, color_fg, color_bg);
+bool test_elements_state = false;
+int test_temperature = 24;
+unsigned long last_temp_time = 0;
 
-	string title = "";
-	switch (current_state) {
-		case MAIN_MENU:
-			title = "";
-			break;
-		case CALIBRATE_1:
-		case CALIBRATE_2:
-		case CALIBRATE_3:
-			title = "CALIBRATING";
-			break;
-		case PICK_PROFILE:
-			title = "PROFILE?";
-			break;
-		case BAKE:
-			title = "REFLOWING";
-			// TODO: use profile name?
-			break;
-		case FINISHED_BAKE:
-		case FINISHED_CALIBRATE:
-			title = "FINISHED";
-			break;
-		default:
-			break;
+// Safety supervisor. Runs from its own high priority timer, independent of
+// loop(), and latches the elements off if anything looks wrong.
+enum SafetyFault {
+	SAFETY_OK,
+	SAFETY_SENSOR_FAULT,
+	SAFETY_OVER_TEMP,
+	SAFETY_NO_RISE,
+	SAFETY_STALE
+};
+const char *safety_fault_names[] = {
+	"OK",
+	"SENSOR FAULT",
+	"OVER TEMPERATURE",
+	"NOT HEATING",
+	"STALE READINGS"
+};
+volatile SafetyFault safety_fault = SAFETY_OK;
+volatile unsigned long last_reading_time = 0;
+volatile unsigned long last_reading_micros = 0;
+// When the last reading that wasn't faulted arrived, and whether the current
+// state needs them to keep arriving.
+volatile unsigned long last_good_reading_time = 0;
+volatile bool readings_required = false;
+volatile unsigned long safety_reaction_us = 0;
+volatile unsigned long supervisor_max_run_us = 0;
+unsigned long rise_start_time = 0;
+int rise_start_temp = -1;
+bool rise_was_heating = false;
+alarm_pool_t *supervisor_pool;
+repeating_timer_t supervisor_timer;
+bool safety_reported = false;
+
+uint16_t get_temperature_color(int temp, int last) {
+	if (temp == -1 || last == -1) {
+		return 0x0000;
 	}
-	send_text(title, 320 / 2, 2, CENTER, color_fg, color_bg);
-
-	string r_action = "";
-	switch (current_state) {
-		case MAIN_MENU:
-		case PICK_PROFILE:
-			r_action = "UP";
-			break;
-		default:
-			break;
+	if (temp > TEMPERATURE_HOT) {
+		return 0x8082;
+	}
+	if (temp > TEMPERATURE_WARM) {
+		return 0xBDA3;
 	}
-	send_text(r_action, 320, 2, RIGHT, color_fg, color_bg);
+	return 0x1423;
 }
 
-void draw_footer() {
-	uint16_t color_fg = ST77XX_WHITE;
-	uint16_t color_bg = current_temp_color;
-	text_bg_color = color_bg;
+/**
+ * Checks for a working MAX31855 on each channel. With no chip fitted the
+ * data line floats, and a read of all zeros passes for 0C with no fault bits
+ * set. A fitted chip always knows its own temperature, so one reporting
+ * exactly nothing, or a temperature no room could be at, is taken as absent.
+ * Channels that haven't answered are tried again before every reading, as the
+ * first conversion takes a while and a probe may be plugged in later.
+ */
+void detect_thermocouples() {
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (thermocouple_present[i]) continue;
+
+		double internal = thermocouples[i].readInternal();
+		double celsius = thermocouples[i].readCelsius();
+		bool blank = internal == 0 && celsius == 0;
+		thermocouple_present[i] = !blank
+			&& internal >= SENSOR_INTERNAL_MIN
+			&& internal <= SENSOR_INTERNAL_MAX;
+	}
+}
 
-	send_rect(0, 240 - HEADER_FOOTER_SIZE, 320, HEADER_FOOTER_SIZE, color_bg);
-	send_config();
+/**
+ * Reads every thermocouple. They all convert continuously, so reading them
+ * back to back gives samples taken at effectively the same moment.
+ */
+void read_thermocouples() {
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (!thermocouple_present[i]) {
+			thermocouple_readings[i] = NAN;
+			thermocouple_faults[i] = MAX31855_FAULT_ALL;
+			continue;
+		}
 
-	string l_action = "";
-	switch (current_state) {
-		case CALIBRATE_1:
-		case CALIBRATE_2:
-		case CALIBRATE_3:
-		case BAKE:
-			l_action = "CANCEL";
-			break;
-		case PICK_PROFILE:
-			l_action = "BACK";
-			break;
-		default:
-			break;
+		thermocouple_readings[i] = thermocouples[i].readCelsius();
+		if (isnan(thermocouple_readings[i])) {
+			thermocouple_faults[i] = thermocouples[i].readError();
+			if (thermocouple_faults[i] == MAX31855_FAULT_NONE) {
+				thermocouple_faults[i] = MAX31855_FAULT_ALL;
+			}
+		} else {
+			thermocouple_faults[i] = MAX31855_FAULT_NONE;
+		}
 	}
-	send_text(l_action, 0, 240 - HEADER_FOOTER_SIZE + 2, LEFT, color_fg, color_bg);
 
-	string r_action = "";
-	switch (current_state) {
-		case MAIN_MENU:
-		case PICK_PROFILE:
-			r_action = "DOWN";
-			break;
-		default:
-			break;
+	// A probe far from the air has most likely come off the board, so it is
+	// left out as if it were faulty.
+	for (int i = 1; i < NUM_THERMOCOUPLES; i++) {
+		if (thermocouple_faults[0] != MAX31855_FAULT_NONE || thermocouple_faults[i] != MAX31855_FAULT_NONE) {
+			continue;
+		}
+		if (fabs(thermocouple_readings[i] - thermocouple_readings[0]) > PROBE_MAX_DISAGREEMENT) {
+			thermocouple_faults[i] = MAX31855_FAULT_ALL;
+		}
 	}
-	send_text(r_action, 320, 240 - HEADER_FOOTER_SIZE + 2, RIGHT, color_fg, color_bg);
-
-	draw_temperature();
 }
 
-bool test_elements_state = false;
-int test_temperature = 24;
-unsigned long last_temp_time = 0;
-
-void set_elements_state(bool on_or_off) {
-	test_elements_state = on_or_off;
-	if (on_or_off) {
-		digitalWrite(TOP_ELEMENT, HIGH);
-		digitalWrite(BOTTOM_ELEMENT, HIGH);
+/**
+ * Combines the thermocouple readings into a single estimate of the board
+ * temperature, as a weighted average of the healthy channels. Returns NaN if
+ * none are healthy.
+ */
+double get_fused_temperature() {
+	unsigned long current_time = millis();
+	unsigned long dt = current_time - last_fusion_time;
+	last_fusion_time = current_time;
+
+	double air = thermocouple_readings[0];
+	if (isnan(air)) {
+		air_board_estimate = NAN;
+	} else if (AIR_TO_BOARD_LAG_MS == 0 || isnan(air_board_estimate)) {
+		air_board_estimate = air;
 	} else {
-		digitalWrite(TOP_ELEMENT, LOW);
-		digitalWrite(BOTTOM_ELEMENT, LOW);
+		double alpha = (double) dt / (AIR_TO_BOARD_LAG_MS + dt);
+		air_board_estimate += (air - air_board_estimate) * alpha;
 	}
-}
 
-uint16_t get_temperature_color() {
-	if (current_temp == -1 || last_temp == -1) {
-		return 0x0000;
-	}
-	if (current_temp > TEMPERATURE_HOT) {
-		return 0x8082;
+	double total = 0;
+	double total_weight = 0;
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (thermocouple_faults[i] != MAX31855_FAULT_NONE) continue;
+		double value = (i == 0) ? air_board_estimate : thermocouple_readings[i];
+		double weight = (i == 0) ? 1 : BOARD_PROBE_WEIGHT;
+		total += value * weight;
+		total_weight += weight;
 	}
-	if (current_temp > TEMPERATURE_WARM) {
-		return 0xBDA3;
+	if (total_weight == 0) {
+		return NAN;
 	}
-	return 0x1423;
+	return total / total_weight;
 }
 
 void update_temperature() {
 	last_temp = current_temp;
 
-	double raw_value = thermocouple.readCelsius();
+	detect_thermocouples();
+	read_thermocouples();
+
+	double hottest = NAN;
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (thermocouple_faults[i] != MAX31855_FAULT_NONE) continue;
+		if (isnan(hottest) || thermocouple_readings[i] > hottest) hottest = thermocouple_readings[i];
+	}
+	hottest_temp = isnan(hottest) ? -1 : (int) (hottest + 0.5);
+
+	double raw_value = get_fused_temperature();
 	if (isnan(raw_value)) {
 		current_temp = -1;
 	} else {
 		current_temp = (int) (raw_value + 0.5);
 	}
+	last_reading_micros = micros();
+	last_reading_time = millis();
+	if (current_temp != -1) {
+		last_good_reading_time = last_reading_time;
+	}
 
 	/*
 	unsigned long t = millis();
@@ -430,38 +736,160 @@ void update_temperature() {
 	*/
 }
 
-void main_menu_setup() {
-	set_elements_state(false);
+/**
+ * Forces the elements off straight from the interrupt and records why. The
+ * fault stays latched until acknowledged from the FAULT screen.
+ */
+void safety_trip(SafetyFault fault, unsigned long detected_us) {
+	digitalWrite(TOP_ELEMENT, LOW);
+	digitalWrite(BOTTOM_ELEMENT, LOW);
+	test_elements_state = false;
 
-	send_config(1, 0xFFFF, &FreeSerif18pt7b);
-	send_print("NEON\nGENESIS\nOVENGELION", 0, 50);
+	if (safety_fault == SAFETY_OK) {
+		safety_fault = fault;
+		safety_reaction_us = micros() - detected_us;
+	}
+}
 
-	send_config();
-	if (is_calibrated) {
-		send_text("CALIBRATION OK", 320, 220, RIGHT, 0x0000, 0x0F00);
+/**
+ * Checks the latest reading from loop() against the absolute limits. Only
+ * reads shared state, never the sensors themselves, so it can't fight
+ * loop() for the bus. Also feeds the watchdog, but only whilst loop() is
+ * still producing readings.
+ */
+bool supervise(repeating_timer_t *timer) {
+	unsigned long start_us = micros();
+	unsigned long current_time = millis();
+	int temp = current_temp;
+	bool heating = test_elements_state;
+
+	if (safety_fault != SAFETY_OK) {
+		// Keep the latch, whatever else has been written to the pins.
+		digitalWrite(TOP_ELEMENT, LOW);
+		digitalWrite(BOTTOM_ELEMENT, LOW);
+	}
+
+	if (heating && temp == -1) {
+		safety_trip(SAFETY_SENSOR_FAULT, last_reading_micros);
+	} else if (hottest_temp > SAFETY_MAX_TEMP) {
+		safety_trip(SAFETY_OVER_TEMP, last_reading_micros);
+	} else if ((heating || readings_required) && current_time - last_good_reading_time > SAFETY_STALE_MS) {
+		// Controlling states ride out the odd faulted reading with the
+		// elements off, but not a sensor that has stopped answering.
+		safety_trip(SAFETY_STALE, start_us);
+	}
+
+	// With the elements held on, the temperature must rise. If it doesn't,
+	// an element or the thermocouple has come loose.
+	if (heating && !rise_was_heating) {
+		rise_start_time = current_time;
+		rise_start_temp = temp;
+	} else if (heating && current_time - rise_start_time >= SAFETY_RISE_WINDOW_MS) {
+		if (temp - rise_start_temp < SAFETY_MIN_RISE) {
+			safety_trip(SAFETY_NO_RISE, start_us);
+		}
+		rise_start_time = current_time;
+		rise_start_temp = temp;
+	}
+	rise_was_heating = heating;
+
+	if (current_time - last_reading_time <= SAFETY_STALE_MS) {
+		rp2040.wdt_reset();
+	}
+
+	// With the elements off there is less to guard against, so run less
+	// often and let core 0 sleep for longer.
+	if (timer != NULL) {
+		timer->delay_us = -1000LL * (heating ? SUPERVISOR_PERIOD_MS : SUPERVISOR_IDLE_PERIOD_MS);
+	}
+
+	unsigned long run_us = micros() - start_us;
+	if (run_us > supervisor_max_run_us) supervisor_max_run_us = run_us;
+	return true;
+}
+
+/**
+ * Runs the supervisor from its own hardware alarm at the highest interrupt
+ * priority, so nothing else can hold it up. Whilst heating, the worst case
+ * reaction time is one period plus one run, as switching the elements on
+ * restarts it at that period.
+ */
+void start_supervisor() {
+	supervisor_pool = alarm_pool_create(SUPERVISOR_ALARM, 1);
+	irq_set_priority(TIMER_IRQ_0 + SUPERVISOR_ALARM, PICO_HIGHEST_IRQ_PRIORITY);
+	alarm_pool_add_repeating_timer_ms(supervisor_pool, -SUPERVISOR_PERIOD_MS, supervise, NULL, &supervisor_timer);
+	rp2040.wdt_begin(WATCHDOG_TIMEOUT_MS);
+}
+
+void set_elements_state(bool on_or_off) {
+	// The supervisor can't be allowed to trip between the check and the
+	// write, or the elements would come back on behind it.
+	noInterrupts();
+	if (safety_fault != SAFETY_OK) {
+		// The supervisor has latched the elements off.
+		on_or_off = false;
+	}
+	bool switched_on = on_or_off && !test_elements_state;
+	test_elements_state = on_or_off;
+	if (on_or_off) {
+		digitalWrite(TOP_ELEMENT, HIGH);
+		digitalWrite(BOTTOM_ELEMENT, HIGH);
 	} else {
-		send_text("NO CALIBRATION", 320, 220, RIGHT, 0x0000, 0xF000);
+		digitalWrite(TOP_ELEMENT, LOW);
+		digitalWrite(BOTTOM_ELEMENT, LOW);
 	}
+	interrupts();
 
-	num_items = 2;
+	// With the elements off the supervisor runs at its idle period, which
+	// would leave the first check after switching on late.
+	if (switched_on && supervisor_pool != NULL) {
+		cancel_repeating_timer(&supervisor_timer);
+		alarm_pool_add_repeating_timer_ms(supervisor_pool, -SUPERVISOR_PERIOD_MS, supervise, NULL, &supervisor_timer);
+	}
 }
 
-void main_menu_loop() {
+unsigned long get_supervisor_worst_case_us() {
+	return SUPERVISOR_PERIOD_MS * 1000 + supervisor_max_run_us;
+}
+
+void fault_setup() {
+	set_elements_state(false);
+
 	send_config(2);
+	send_print("ELEMENTS FORCED OFF\n", 0, 40);
+	send_print(safety_fault_names[safety_fault]);
+	send_print("\nREACTION: " + std::to_string(safety_reaction_us) + "us");
+	send_print("\nWORST CASE: " + std::to_string(get_supervisor_worst_case_us()) + "us");
+
+	if (!safety_reported) {
+		Serial.printf("SAFETY: %s, reacted in %luus, worst case %luus\n",
+				safety_fault_names[safety_fault],
+				safety_reaction_us,
+				get_supervisor_worst_case_us());
+		safety_reported = true;
+	}
+}
 
-	if (last_drawn_selection != selection) {
-		int fg, bg;
+void clear_safety_fault() {
+	safety_fault = SAFETY_OK;
+	safety_reported = false;
+	rise_was_heating = false;
+	next_state = MAIN_MENU;
+}
 
-		if (selection == 0) { fg=0x0000; bg=0xFFFF; }
-		else { fg=0xFFFF; bg=0x0000; }
-		send_text("BAKE", 320 / 2, 165, CENTER, fg, bg);
+void main_menu_setup() {
+	set_elements_state(false);
 
-		if (selection == 1) { fg=0x0000; bg=0xFFFF; }
-		else { fg=0xFFFF; bg=0x0000; }
-		send_text("CALIBRATE", 320 / 2, 195, CENTER, fg, bg);
+	send_blit(&splash_asset);
 
-		last_drawn_selection = selection;
+	send_config();
+	if (is_calibrated) {
+		send_text("CALIBRATION OK", 320, 220, RIGHT, 0x0000, 0x0F00);
+	} else {
+		send_text("NO CALIBRATION", 320, 220, RIGHT, 0x0000, 0xF000);
 	}
+
+	num_items = 2;
 }
 
 void calibrate_1_setup() {
@@ -492,15 +920,6 @@ void calibrate_1_loop() {
 		next_state = CALIBRATE_2;
 		return;
 	}
-
-	if (last_drawn_time == 0 || current_time - last_drawn_time >= 1000) {
-		send_config(3);
-		send_text(get_time_string(current_time - calibrate_1_start_time),
-				320 / 2,
-				240 / 2,
-				CENTER);
-		last_drawn_time = current_time;
-	}
 }
 
 void calibrate_2_setup() {
@@ -528,15 +947,6 @@ void calibrate_2_loop() {
 		next_state = CALIBRATE_3 ;
 		return;
 	}
-
-	if (last_drawn_time == 0 || current_time - last_drawn_time >= 1000) {
-		send_config(3);
-		send_text( get_time_string(current_time - calibrate_2_start_time),
-				320 / 2,
-				240 / 2,
-				CENTER);
-		last_drawn_time = current_time;
-	}
 }
 
 void calibrate_3_setup() {
@@ -561,35 +971,99 @@ void calibrate_3_loop() {
 		next_state = FINISHED_CALIBRATE;
 		return;
 	}
+}
 
-	if (last_drawn_time == 0 || current_time - last_drawn_time >= 1000) {
-		send_config(3);
-		send_text( get_time_string(current_time - calibrate_3_start_time),
-				320 / 2,
-				240 / 2,
-				CENTER);
-		last_drawn_time = current_time;
+/**
+ * Reads the settings record straight out of flash. Returns false if it is
+ * missing, from another firmware version, or corrupt.
+ */
+bool read_flash_settings() {
+	const SettingsRecord *record = (const SettingsRecord *) _EEPROM_start;
+	if (record->magic != SETTINGS_MAGIC || record->version != SETTINGS_VERSION) {
+		return false;
+	}
+	if (record->crc != crc32(record, offsetof(SettingsRecord, crc))) {
+		return false;
 	}
+
+	calibration_cool_lag_time = record->cool_lag_time;
+	calibration_heat_lag_time = record->heat_lag_time;
+	calibration_lag_degrees = record->lag_degrees;
+	model_heat_rate = record->heat_rate;
+	model_loss_rate = record->loss_rate;
+	model_adapted = model_heat_rate > 0 && model_loss_rate > 0;
+	return true;
 }
 
-void finished_calibrate_setup() {
-	set_elements_state(false);
+/**
+ * Rewrites the settings sector. Core 1 runs from flash too, so it must be
+ * parked whilst the sector is erased and programmed.
+ */
+void write_flash_settings() {
+	uint8_t page[FLASH_PAGE_SIZE];
+	memset(page, 0xFF, sizeof(page));
+
+	SettingsRecord record{
+		SETTINGS_MAGIC,
+		SETTINGS_VERSION,
+		(uint32_t) calibration_cool_lag_time,
+		(uint32_t) calibration_heat_lag_time,
+		calibration_lag_degrees,
+		model_adapted ? model_heat_rate : 0,
+		model_adapted ? model_loss_rate : 0,
+		0
+	};
+	record.crc = crc32(&record, offsetof(SettingsRecord, crc));
+	memcpy(page, &record, sizeof(record));
+
+	uint32_t offset = (intptr_t) _EEPROM_start - (intptr_t) XIP_BASE;
+	rp2040.idleOtherCore();
+	noInterrupts();
+	flash_range_erase(offset, FLASH_SECTOR_SIZE);
+	flash_range_program(offset, page, FLASH_PAGE_SIZE);
+	interrupts();
+	rp2040.resumeOtherCore();
+}
 
-	unsigned long current_time = millis();
+/**
+ * Loads calibration, preferring the flash record and falling back to the
+ * CALIBRATION file on LittleFS.
+ */
+void load_settings() {
+	if (read_flash_settings()) {
+		is_calibrated = true;
+		return;
+	}
 
-	send_config(2);
-	send_print("CALIBRATION COMPLETE!\n", 0, 20);
-	send_print("TOTAL TIME: ");
-	send_print(get_time_string(current_time - calibrate_1_start_time));
-	send_print("\nCOOL LAG TIME: ");
-	send_print(get_time_string(calibration_cool_lag_time));
-	send_print("\nHEAT LAG TIME: ");
-	send_print(get_time_string(calibration_heat_lag_time));
-	send_print("\nLAG DEGREES: ");
-	send_print(std::to_string(calibration_lag_degrees));
+	bool r = LittleFS.begin();
+	if (!r) {
+		digitalWrite(LED_BLUE, LOW);
+	} else {
+		File f = LittleFS.open("CALIBRATION", "r");
+		if (!f) {
+			digitalWrite(LED_RED, LOW);
+		} else {
+			calibration_cool_lag_time = f.parseInt();
+			calibration_heat_lag_time = f.parseInt();
+			calibration_lag_degrees = f.parseInt();
+			// Older files stop here, and read back as not adapted.
+			model_heat_rate = f.parseFloat();
+			model_loss_rate = f.parseFloat();
+			model_adapted = model_heat_rate > 0 && model_loss_rate > 0;
+			f.close();
+			is_calibrated = true;
+
+			// Copy it into flash once both cores are up, so that the next
+			// boot can skip the filesystem.
+			settings_need_flash = true;
+		}
+		LittleFS.end();
+	}
+}
+
+void save_settings() {
+	write_flash_settings();
 
-	send_print("\nWRITING TO FLASH... ");
-	
 	bool r = LittleFS.begin();
 	if (!r) {
 		digitalWrite(LED_BLUE, LOW);
@@ -601,22 +1075,56 @@ void finished_calibrate_setup() {
 			f.println(calibration_cool_lag_time);
 			f.println(calibration_heat_lag_time);
 			f.println(calibration_lag_degrees);
+			f.println(model_adapted ? model_heat_rate : 0, 6);
+			f.println(model_adapted ? model_loss_rate : 0, 6);
 			f.close();
 		}
 		LittleFS.end();
 	}
+}
 
-	// Hooray! :)
-	is_calibrated = true;
-	send_print("OK!");
+void report_boot() {
+	Serial.printf("BOOT: settings %lums, sensor %lums, display %lums, first screen %lums (target %dms%s)\n",
+			boot_marks[BOOT_SETTINGS_LOADED] - boot_marks[BOOT_START],
+			boot_marks[BOOT_SENSOR_READY] - boot_marks[BOOT_START],
+			boot_marks[BOOT_DISPLAY_READY] - boot_marks[BOOT_START],
+			boot_marks[BOOT_FIRST_SCREEN] - boot_marks[BOOT_START],
+			BOOT_TARGET_MS,
+			boot_marks[BOOT_FIRST_SCREEN] - boot_marks[BOOT_START] > BOOT_TARGET_MS ? ", MISSED" : "");
 }
 
-int get_desired_temperature(ReflowState state, unsigned long time_in_state) {
-	// Easy states first.
-	if (state == PREHEAT) {
-		return preheat_temp;
-	}
-	if (state == COOL) {
+void finished_calibrate_setup() {
+	set_elements_state(false);
+
+	unsigned long current_time = millis();
+
+	send_config(2);
+	send_print("CALIBRATION COMPLETE!\n", 0, 20);
+	send_print("TOTAL TIME: ");
+	send_print(get_time_string(current_time - calibrate_1_start_time));
+	send_print("\nCOOL LAG TIME: ");
+	send_print(get_time_string(calibration_cool_lag_time));
+	send_print("\nHEAT LAG TIME: ");
+	send_print(get_time_string(calibration_heat_lag_time));
+	send_print("\nLAG DEGREES: ");
+	send_print(std::to_string(calibration_lag_degrees));
+
+	send_print("\nWRITING TO FLASH... ");
+	// A fresh calibration supersedes anything learnt from the old one.
+	model_adapted = false;
+	save_settings();
+
+	// Hooray! :)
+	is_calibrated = true;
+	send_print("OK!");
+}
+
+int get_desired_temperature(ReflowState state, unsigned long time_in_state) {
+	// Easy states first.
+	if (state == PREHEAT) {
+		return preheat_temp;
+	}
+	if (state == COOL) {
 		return 0;
 	}
 
@@ -625,7 +1133,7 @@ int get_desired_temperature(ReflowState state, unsigned long time_in_state) {
 	long duration = 1;
 	switch (state) {
 		case SOAK:
-			start = preheat_temp;
+			start = soak_start_temp;
 			end = soak_temp;
 			duration = soak_duration;
 			break;
@@ -646,6 +1154,40 @@ int get_desired_temperature(ReflowState state, unsigned long time_in_state) {
 	return (int) (desired_temp + 0.5);
 }
 
+ThermalModel get_calibrated_model() {
+	return ThermalModel::from_calibration(
+			calibration_cool_lag_time,
+			calibration_heat_lag_time,
+			calibration_lag_degrees);
+}
+
+/**
+ * The model to plan against: the calibration, refined by previous bakes.
+ */
+ThermalModel get_thermal_model() {
+	ThermalModel model = get_calibrated_model();
+	if (model_adapted) {
+		model.heat_rate = model_heat_rate;
+		model.loss_rate = model_loss_rate;
+	}
+	return model;
+}
+
+/**
+ * Whether the estimator has learnt enough beyond the stored model to be worth
+ * writing to flash.
+ */
+bool is_estimate_worth_saving() {
+	if (!is_calibrated || !estimator.is_converged()) {
+		return false;
+	}
+	if (!model_adapted) {
+		return true;
+	}
+	return fabsf(estimator.model.heat_rate - model_heat_rate) > model_heat_rate * MODEL_SAVE_CHANGE
+		|| fabsf(estimator.model.loss_rate - model_loss_rate) > model_loss_rate * MODEL_SAVE_CHANGE;
+}
+
 void bake_setup() {
 	int graph_width = 280;
 	int graph_height = 140;
@@ -662,10 +1204,11 @@ void bake_setup() {
 		soak_duration +
 		reflow_duration +
 		cool_duration;
-	for (int x = graph_x; x < graph_x + graph_width; x++) {
-		double progress = (x - graph_x) / (float) graph_width;
-		unsigned long current_time = total_time * progress;
-
+	unsigned long time_per_pixel = total_time / graph_width;
+	float temp_scale = (float) graph_height / 275;
+	unsigned long current_time = 0;
+	for (int x = graph_x; x < graph_x + graph_width; x++, current_time += time_per_pixel) {
+		float progress;
 		int desired_temp;
 		if (current_time < preheat_duration) {
 			progress = current_time / (float) preheat_duration;
@@ -683,23 +1226,343 @@ void bake_setup() {
 			}
 			desired_temp = get_desired_temperature(state, time_in_state);
 		}
-		double scaled_temp = ((float) graph_height / 275) * desired_temp;
-		int y = graph_y + graph_height - scaled_temp;
+		int y = graph_y + graph_height - (int) (temp_scale * desired_temp);
 		send_pixel(x, y, 0xFFFF);
 	}
 }
 
-void pick_profile_loop() {
-	// TODO: redraw items if selection changed
+/**
+ * Loads the profile from the PROFILE file on LittleFS, if there is one. This
+ * is done when picking a profile rather than at boot, so that a freshly
+ * uploaded profile is always picked up.
+ */
+void load_profile() {
+	bool r = LittleFS.begin();
+	if (!r) {
+		return;
+	}
+
+	File f = LittleFS.open("PROFILE", "r");
+	if (f) {
+		int values[7];
+		for (int i = 0; i < 7; i++) {
+			values[i] = f.parseInt();
+		}
+		f.close();
+
+		// parseInt() gives zero on failure, so only take complete profiles.
+		bool valid = true;
+		for (int i = 0; i < 7; i++) {
+			if (values[i] <= 0) valid = false;
+		}
+		if (valid) {
+			preheat_temp = values[0];
+			preheat_duration = values[1];
+			soak_temp = values[2];
+			soak_duration = values[3];
+			reflow_temp = values[4];
+			reflow_duration = values[5];
+			cool_duration = values[6];
+		}
+	}
+	LittleFS.end();
+}
+
+void pick_profile_setup() {
+	load_profile();
+	bake_setup();
+	num_items = MAX_BATCH_RUNS;
+}
+
+/**
+ * Starts the next run of a batch. If the oven is still warm from the last
+ * run, preheat is skipped and the soak ramp is anchored at the current
+ * temperature instead.
+ */
+void bake_run_setup() {
+	unsigned long current_time = millis();
+	if (batch_runs_done == 0) {
+		batch_start_time = current_time;
+	}
+	run_start_time = current_time;
+
+	holding_at_temp = -1;
+	holding_at_time = -1;
+	holding_at_reheat_time = -1;
+
+	reflow_state_start_time = current_time;
+	if (current_temp != -1 && current_temp >= preheat_temp - batch_warm_margin) {
+		reflow_state = SOAK;
+		soak_start_temp = current_temp;
+	} else {
+		reflow_state = PREHEAT;
+		soak_start_temp = preheat_temp;
+	}
+
+	estimator.begin(get_thermal_model(), get_calibrated_model());
+
+	bake_setup();
+
+	send_config(2);
+	send_text("RUN " + std::to_string(batch_runs_done + 1) + "/" + std::to_string(batch_runs),
+			320 / 2,
+			40,
+			CENTER);
+}
+
+/**
+ * Called when a run has cooled enough to unload. Records how long the run
+ * took and decides whether the batch carries on.
+ */
+void bake_run_finished() {
+	unsigned long current_time = millis();
+	last_cycle_time = current_time - run_start_time;
+	batch_runs_done++;
+
+	// Keep what this run taught us about the oven for the next one.
+	if (is_estimate_worth_saving()) {
+		model_adapted = true;
+		model_heat_rate = estimator.model.heat_rate;
+		model_loss_rate = estimator.model.loss_rate;
+		save_settings();
+	}
+
+	if (batch_runs_done < batch_runs) {
+		next_state = BATCH_IDLE;
+	} else {
+		next_state = FINISHED_BAKE;
+	}
+}
+
+/**
+ * Boards per hour across the batch so far, measured from the start of the
+ * first run so that idle time spent loading boards is included.
+ */
+int get_boards_per_hour() {
+	unsigned long elapsed = millis() - batch_start_time;
+	if (batch_runs_done == 0 || elapsed == 0) {
+		return 0;
+	}
+	return (int) (batch_runs_done * 3'600'000UL / elapsed);
+}
+
+void draw_batch_stats() {
+	send_config(2);
+	send_print("RUNS DONE: ", 0, 40);
+	send_print(std::to_string(batch_runs_done) + "/" + std::to_string(batch_runs));
+	send_print("\nLAST CYCLE: ");
+	send_print(get_time_string(last_cycle_time));
+	send_print("\nBATCH TIME: ");
+	send_print(get_time_string(millis() - batch_start_time));
+	send_print("\nBOARDS/HOUR: ");
+	send_print(std::to_string(get_boards_per_hour()));
+	send_print("\nCOOLING SAVED: ");
+	send_print((last_cool_saving < 0 ? "-" : "") + get_time_string(labs(last_cool_saving)));
+}
+
+/**
+ * Where to hold the chamber between runs. Half the warm margin below
+ * preheat, so that the swing around it stays within the margin and the next
+ * run always starts warm.
+ */
+int get_batch_idle_temp() {
+	return preheat_temp - batch_warm_margin / 2;
+}
+
+void batch_idle_setup() {
+	draw_batch_stats();
+	send_print("\n\nHOLDING AT ");
+	send_print(std::to_string(get_batch_idle_temp()) + "C");
+}
+
+/**
+ * Holds the chamber at the idle temperature between runs, so the next run
+ * can start warm.
+ */
+void batch_idle_loop() {
+	if (current_temp == -1) {
+		set_elements_state(false);
+		return;
+	}
+	set_elements_state(current_temp < get_batch_idle_temp());
+}
+
+void finished_bake_setup() {
+	set_elements_state(false);
+	draw_batch_stats();
+	batch_runs_done = 0;
+}
+
+/**
+ * Beeps, if the buzzer is usable. On this board it shares a pin with the air
+ * thermocouple's chip select, where it would corrupt readings, so it stays
+ * quiet unless one of them is moved.
+ */
+void beep() {
+#if BUZZER != TEMP_CS
+	tone(BUZZER, BUZZER_FREQUENCY, BUZZER_BEEP_MS);
+#endif
+}
+
+void set_door_led(bool on) {
+	digitalWrite(LED_GREEN, on ? LOW : HIGH);
+}
+
+float get_door_loss_rate(const ThermalModel& model) {
+	return door_loss_rate > 0 ? door_loss_rate : model.loss_rate * DOOR_LOSS_FACTOR;
+}
+
+/**
+ * How long the shut oven would take to cool from temp to COOL_DONE_TEMP, with
+ * the elements off.
+ */
+unsigned long predict_cool_time(float temp) {
+	ThermalSimulation sim(get_thermal_model(), temp);
+	while (sim.temp >= COOL_DONE_TEMP && sim.time < 30 * 60'000UL) {
+		sim.step(COOL_PREDICT_STEP_MS, false);
+	}
+	return sim.time;
+}
+
+/**
+ * Plans when to prompt for the door, as COOL starts. The door can open once
+ * the elements' stored heat has gone and the door-open rate of cooling has
+ * fallen to the paste's limit. If that isn't until cooling is done anyway,
+ * there is nothing to prompt for.
+ */
+void cooling_assist_begin() {
+	cooling_assist_active = is_calibrated && current_temp != -1;
+	door_prompted = false;
+	door_beeps = 0;
+	max_cool_rate = 0;
+	door_loss_total = 0;
+	door_loss_samples = 0;
+	last_cool_saving = 0;
+	cooling_status = COOLING_NONE;
+	if (!cooling_assist_active) return;
+
+	ThermalModel model = get_thermal_model();
+	float door_rate = get_door_loss_rate(model);
+	ThermalSimulation sim(model, current_temp);
+	while (sim.temp >= COOL_DONE_TEMP && sim.time < 30 * 60'000UL) {
+		bool door_safe = sim.time >= model.cool_lag_time
+			&& door_rate * (sim.temp - model.ambient) <= COOL_MAX_SLOPE;
+		if (door_safe) {
+			door_prompt_time = sim.time;
+			cooling_status = COOLING_COUNTDOWN;
+			return;
+		}
+		sim.step(COOL_PREDICT_STEP_MS, false);
+	}
+	cooling_assist_active = false;
+}
+
+/**
+ * Counts down to the door, then prompts for it and keeps an eye on how fast
+ * the board is cooling. The LED blinks if it is too fast.
+ */
+void cooling_assist_loop() {
+	if (!cooling_assist_active) return;
+
+	unsigned long current_time = millis();
+	unsigned long time_in_cool = current_time - reflow_state_start_time;
+	if (!door_prompted) {
+		if (time_in_cool < door_prompt_time) {
+			return;
+		}
+
+		// The stored heat has gone by now, so this is a fair baseline.
+		predicted_cool_time = time_in_cool + predict_cool_time(current_temp);
+		door_prompted = true;
+		door_beeps = 0;
+		cool_rate_window_time = current_time;
+		cool_rate_window_temp = current_temp;
+		set_door_led(true);
+		cooling_status = COOLING_OPEN_NOW;
+	}
+
+	if (door_beeps < BUZZER_BEEPS && time_in_cool - door_prompt_time >= door_beeps * 2UL * BUZZER_BEEP_MS) {
+		beep();
+		door_beeps++;
+	}
+
+	// Blink on every pass, though the rate is only measured once a window.
+	set_door_led(cooling_status != COOLING_TOO_FAST || (current_time / 500) % 2 == 0);
+
+	if (current_time - cool_rate_window_time < COOL_RATE_WINDOW_MS) {
+		return;
+	}
+	float window = (current_time - cool_rate_window_time) / 1000.0f;
+	float rate = (cool_rate_window_temp - current_temp) / window;
+	if (rate > max_cool_rate) max_cool_rate = rate;
+
+	// Well beyond what the shut oven would manage means the door really is
+	// open, so learn how much it helps.
+	ThermalModel model = get_thermal_model();
+	float excess = (cool_rate_window_temp + current_temp) / 2.0f - model.ambient;
+	if (excess > 0 && rate > 1.5f * model.loss_rate * excess) {
+		door_loss_total += rate / excess;
+		door_loss_samples++;
+	}
+
+	cooling_status = rate > COOL_MAX_SLOPE ? COOLING_TOO_FAST : COOLING_DOOR_OPEN;
+
+	cool_rate_window_time = current_time;
+	cool_rate_window_temp = current_temp;
+}
+
+/**
+ * Records how much sooner the run cooled than the shut oven would have, and
+ * what this door does for the next run's prediction.
+ */
+void cooling_assist_finish() {
+	if (!cooling_assist_active) return;
+	cooling_assist_active = false;
+	cooling_status = COOLING_NONE;
+	set_door_led(false);
+	if (!door_prompted) return;
+
+	unsigned long time_in_cool = millis() - reflow_state_start_time;
+	last_cool_saving = (long) predicted_cool_time - (long) time_in_cool;
+	if (door_loss_samples > 0) {
+		door_loss_rate = door_loss_total / door_loss_samples;
+	}
+	Serial.printf("COOL: door at %lus, took %lus, max %d.%dC/s, saved %lds\n",
+			door_prompt_time / 1000,
+			time_in_cool / 1000,
+			(int) max_cool_rate, (int) (max_cool_rate * 10) % 10,
+			last_cool_saving / 1000);
+}
+
+void bake_exit() {
+	set_elements_state(false);
+	cooling_assist_active = false;
+	cooling_status = COOLING_NONE;
+	set_door_led(false);
 }
 
 void reflow_loop() {
+	if (current_temp == -1) {
+		// Nothing to steer by, so coast until a good reading arrives. The
+		// supervisor faults us if that takes too long.
+		set_elements_state(false);
+		return;
+	}
+
 	unsigned long current_time = millis();
+
+	// Only learn whilst the oven is shut up and under control; cooling may
+	// well be helped along with the door open.
+	if (is_calibrated && reflow_state != COOL) {
+		estimator.add_sample(current_time, current_temp, test_elements_state);
+	}
+
 	switch (reflow_state) {
 		case PREHEAT:
 			if (current_temp > preheat_temp) {
 				reflow_state = SOAK;
 				reflow_state_start_time = current_time;
+				soak_start_temp = preheat_temp;
 				return;
 			}
 			break;
@@ -715,12 +1578,15 @@ void reflow_loop() {
 					&& current_temp >= reflow_temp - calibration_lag_degrees) {
 				reflow_state = COOL;
 				reflow_state_start_time = current_time;
+				cooling_assist_begin();
 				return;
 			}
 			break;
 		case COOL:
-			if (current_temp < 150) {
-				next_state = FINISHED_BAKE;
+			cooling_assist_loop();
+			if (current_temp < COOL_DONE_TEMP) {
+				cooling_assist_finish();
+				bake_run_finished();
 				return;
 			}
 			break;
@@ -729,6 +1595,18 @@ void reflow_loop() {
 	unsigned long time_in_state = current_time - reflow_state_start_time;
 	int desired_temp = get_desired_temperature(reflow_state, time_in_state);
 
+	if (holding_at_time != -1 && holding_at_temp != desired_temp) {
+		// The curve has moved on from the temperature we were holding at.
+		holding_at_temp = -1;
+		holding_at_time = -1;
+		holding_at_reheat_time = -1;
+	}
+
+	if (holding_at_time == -1) {
+		// Not holding, so heat towards the curve.
+		set_elements_state(current_temp < desired_temp);
+	}
+
 	if (desired_temp - current_temp < calibration_lag_degrees && holding_at_time == -1) {
 		// We are within lag_temp of the temperature we should be aiming for.
 		// Time to start turning the elements off!
@@ -757,7 +1635,7 @@ void reflow_loop() {
 				// Turn the elements back on for a bit.
 				set_elements_state(true);
 				holding_at_reheat_time = current_time;
-			} else if (current_time - holding_at_reheat_time < calibration_heat_lag_time) {
+			} else if (current_time - holding_at_reheat_time >= calibration_heat_lag_time) {
 				// We have held them on for long enough. Turn them back off,
 				// and begin the cycle again.
 				set_elements_state(false);
@@ -770,103 +1648,554 @@ void reflow_loop() {
 	}
 }
 
-bool read_debounced(int pin) {
-	delay(10);
-	return digitalRead(pin);
+void push_input_event(Button button, InputEventType type) {
+	uint8_t next = (input_head + 1) % INPUT_QUEUE_SIZE;
+	if (next == input_tail) {
+		// Full. Nobody is reading, so dropping the press is the best option.
+		return;
+	}
+	input_events[input_head] = (button << 2) | type;
+	input_head = next;
 }
 
-void top_left_pushed() {
-	if (read_debounced(BUTTON_TOP_LEFT)) return;
-	switch (current_state) {
-		case MAIN_MENU:
-			if (selection == 0) {
-				next_state = PICK_PROFILE;
+/**
+ * Samples every button. A button only changes state once the last few samples
+ * agree, which debounces it without ever waiting. Held buttons generate a long
+ * press and auto-repeats that speed up the longer they are held.
+ */
+bool sample_buttons(repeating_timer_t *timer) {
+	for (int i = 0; i < NUM_BUTTONS; i++) {
+		ButtonState& b = buttons[i];
+		b.history = (b.history << 1) | (digitalRead(b.pin) == LOW);
+
+		if (!b.pressed && (b.history & BUTTON_DEBOUNCE_MASK) == BUTTON_DEBOUNCE_MASK) {
+			b.pressed = true;
+			b.held_time = 0;
+			b.next_repeat_time = BUTTON_REPEAT_DELAY_MS;
+			b.repeat_interval = BUTTON_REPEAT_START_MS;
+			push_input_event((Button) i, PRESS);
+		} else if (b.pressed && (b.history & BUTTON_DEBOUNCE_MASK) == 0) {
+			b.pressed = false;
+		} else if (b.pressed) {
+			b.held_time += BUTTON_SAMPLE_MS;
+			if (b.held_time == BUTTON_LONG_PRESS_MS) {
+				push_input_event((Button) i, LONG_PRESS);
 			}
-			if (selection == 1) {
-				next_state = CALIBRATE_1;
+			if (b.held_time >= b.next_repeat_time) {
+				push_input_event((Button) i, REPEAT);
+				b.next_repeat_time += b.repeat_interval;
+				b.repeat_interval = b.repeat_interval * 3 / 4;
+				if (b.repeat_interval < BUTTON_REPEAT_MIN_MS) b.repeat_interval = BUTTON_REPEAT_MIN_MS;
 			}
-			break;
-		case FINISHED_BAKE:
-		case FINISHED_CALIBRATE:
-			next_state = MAIN_MENU;
-			break;
-		default:
-			break;
+		}
 	}
+
+	// Once every button has settled released there is nothing to sample,
+	// so stop until wake_buttons() sees the next press.
+	for (int i = 0; i < NUM_BUTTONS; i++) {
+		if (buttons[i].history != 0) return true;
+	}
+	button_timer_running = false;
+	return false;
 }
 
-void top_right_pushed() {
-	if (read_debounced(BUTTON_TOP_RIGHT)) return;
-	switch (current_state) {
-		case MAIN_MENU:
-		case PICK_PROFILE:
-			selection = (selection + num_items - 1) % num_items;
-			break;
-		default:
-			break;
+/**
+ * Edge interrupt on any button. Restarts the sampling timer if it had
+ * stopped, and leaves debouncing to it.
+ */
+void wake_buttons() {
+	if (!button_timer_running) {
+		button_timer_running = true;
+		add_repeating_timer_ms(-BUTTON_SAMPLE_MS, sample_buttons, NULL, &button_timer);
 	}
 }
 
-void bottom_left_pushed() {
-	if (read_debounced(BUTTON_BOTTOM_LEFT)) return;
-	switch (current_state) {
-		case FINISHED_BAKE:
-		case FINISHED_CALIBRATE:
-			next_state = MAIN_MENU;
-			break;
-		default:
-			break;
+void nothing() {}
+
+void menu_up() {
+	selection = (selection + num_items - 1) % num_items;
+}
+
+void menu_down() {
+	selection = (selection + 1) % num_items;
+}
+
+void main_menu_pick() {
+	if (selection == 0) {
+		next_state = PICK_PROFILE;
+	}
+	if (selection == 1) {
+		next_state = CALIBRATE_1;
 	}
 }
 
-void bottom_right_pushed() {
-	if (read_debounced(BUTTON_BOTTOM_RIGHT)) return;
-	switch (current_state) {
-		case MAIN_MENU:
-		case PICK_PROFILE:
-			selection = (selection + 1) % num_items;
-			break;
-		default:
+void pick_profile_pick() {
+	batch_runs = selection + 1;
+	batch_runs_done = 0;
+	next_state = BAKE;
+}
+
+void go_to_main_menu() {
+	next_state = MAIN_MENU;
+}
+
+void go_to_bake() {
+	next_state = BAKE;
+}
+
+void go_to_finished_bake() {
+	next_state = FINISHED_BAKE;
+}
+
+void elements_off() {
+	set_elements_state(false);
+}
+
+// ** UI RENDERING ** //
+
+/**
+ * Publishes what the screen should show. Runs on core 0.
+ */
+void publish_snapshot() {
+	unsigned long current_time = millis();
+	unsigned long time_in_reflow_state = current_time - reflow_state_start_time;
+
+	OvenSnapshot next;
+	next.state = current_state;
+	next.reflow_state = reflow_state;
+	next.temp = current_temp;
+	next.last_temp = last_temp;
+	next.setpoint = -1;
+	if (current_state == BAKE) {
+		next.setpoint = get_desired_temperature(reflow_state, time_in_reflow_state);
+	}
+	next.faults = 0;
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (thermocouple_faults[i] != MAX31855_FAULT_NONE) next.faults |= 1 << i;
+	}
+	next.selection = selection;
+	next.cooling = cooling_status;
+	next.state_time = current_time - state_start_time;
+	next.door_countdown = 0;
+	if (cooling_status == COOLING_COUNTDOWN && time_in_reflow_state < door_prompt_time) {
+		next.door_countdown = door_prompt_time - time_in_reflow_state;
+	}
+
+	snapshot_sequence = snapshot_sequence + 1;
+	__dmb();
+	snapshot = next;
+	__dmb();
+	snapshot_sequence = snapshot_sequence + 1;
+	__sev();
+}
+
+/**
+ * Takes a consistent copy of the latest snapshot. Runs on core 1. Returns
+ * false if core 0 was part way through publishing.
+ */
+bool read_snapshot(OvenSnapshot& out, uint32_t& sequence) {
+	sequence = snapshot_sequence;
+	if (sequence & 1) return false;
+	__dmb();
+	out = snapshot;
+	__dmb();
+	return snapshot_sequence == sequence;
+}
+
+Adafruit_ST7789 core1_display = Adafruit_ST7789(DISPLAY_CS, DISPLAY_DC, DISPLAY_MOSI, DISPLAY_SCLK);
+
+void core1_config(int text_size) {
+	core1_display.setFont();
+	core1_display.setTextSize(text_size);
+}
+
+void core1_draw_text(const TextType& text, const char *str) {
+	int16_t x, y;
+	uint16_t w, h;
+	core1_display.getTextBounds(str, 0, 0, &x, &y, &w, &h);
+
+	x = text.x;
+	y = text.y;
+
+	if (text.justify == CENTER) x -= w / 2;
+	if (text.justify == RIGHT) x -= w;
+
+	core1_display.setTextColor(text.fg_color);
+	core1_display.fillRect(x, y, w, h, text.bg_color);
+	core1_display.setCursor(x, y);
+	core1_display.print(str);
+}
+
+// Per state drawing of a snapshot, on core 1. drawn is the snapshot last
+// drawn over this screen, or NULL if it has just been cleared, so only what
+// changed needs drawing.
+
+void render_nothing(const OvenSnapshot& now, const OvenSnapshot *drawn) {}
+
+void main_menu_render(const OvenSnapshot& now, const OvenSnapshot *drawn) {
+	if (drawn != NULL && drawn->selection == now.selection) return;
+
+	const char *items[] = { "BAKE", "CALIBRATE" };
+	core1_config(2);
+	for (int i = 0; i < 2; i++) {
+		uint16_t fg = now.selection == i ? 0x0000 : 0xFFFF;
+		uint16_t bg = now.selection == i ? 0xFFFF : 0x0000;
+		core1_draw_text(TextType{ 320 / 2, 165 + 30 * i, fg, bg, CENTER }, items[i]);
+	}
+}
+
+void calibrate_render(const OvenSnapshot& now, const OvenSnapshot *drawn) {
+	if (drawn != NULL && drawn->state_time / 1000 == now.state_time / 1000) return;
+
+	char text[DRAW_TEXT_MAX];
+	format_time(text, sizeof(text), now.state_time);
+	core1_config(3);
+	core1_draw_text(TextType{ 320 / 2, 240 / 2, 0xFFFF, 0x0000, CENTER }, text);
+}
+
+void pick_profile_render(const OvenSnapshot& now, const OvenSnapshot *drawn) {
+	if (drawn != NULL && drawn->selection == now.selection) return;
+
+	char text[DRAW_TEXT_MAX];
+	snprintf(text, sizeof(text), "RUNS: %d ", now.selection + 1);
+	core1_config(2);
+	core1_draw_text(TextType{ 320 / 2, 40, 0xFFFF, 0x0000, CENTER }, text);
+}
+
+void bake_render(const OvenSnapshot& now, const OvenSnapshot *drawn) {
+	char text[DRAW_TEXT_MAX];
+	core1_config(2);
+
+	if (drawn == NULL || drawn->setpoint != now.setpoint) {
+		snprintf(text, sizeof(text), "SET %3dC", now.setpoint);
+		core1_draw_text(TextType{ 320, 40, 0xFFFF, 0x0000, RIGHT }, text);
+	}
+
+	if (drawn != NULL && drawn->cooling == now.cooling
+			&& drawn->door_countdown / 1000 == now.door_countdown / 1000) {
+		return;
+	}
+	const char *status = "";
+	char time[16];
+	char countdown[DRAW_TEXT_MAX];
+	switch (now.cooling) {
+		case COOLING_COUNTDOWN:
+			format_time(time, sizeof(time), now.door_countdown);
+			snprintf(countdown, sizeof(countdown), "OPEN DOOR IN %s", time);
+			status = countdown;
 			break;
+		case COOLING_OPEN_NOW: status = "OPEN DOOR NOW"; break;
+		case COOLING_DOOR_OPEN: status = "DOOR OPEN"; break;
+		case COOLING_TOO_FAST: status = "TOO FAST, CLOSE DOOR"; break;
+		default: break;
+	}
+	// Padded to a fixed width, so each message covers the last.
+	snprintf(text, sizeof(text), "%-20s", status);
+	core1_draw_text(TextType{ 320 / 2, 60, 0xFFFF, 0x0000, CENTER }, text);
+}
+
+/**
+ * Everything that differs between states: what happens on entering, on each
+ * tick and on leaving, how core 1 draws it, what the header and footer say,
+ * and what each button does for each kind of input event.
+ */
+class StateInfo {
+	public:
+		State state;
+		void (*setup)();
+		void (*tick)();
+		void (*exit)();
+		void (*render)(const OvenSnapshot& now, const OvenSnapshot *drawn);
+		// How often tick() runs and the temperature is read.
+		unsigned long tick_ms;
+		// Only waiting on the operator, so the backlight may dim.
+		bool idle;
+		const char *header_left;
+		const char *title;
+		const char *header_right;
+		const char *footer_left;
+		const char *footer_right;
+		// Indexed by Button, then by InputEventType.
+		void (*on_input[NUM_BUTTONS][NUM_INPUT_EVENTS])();
+};
+
+constexpr StateInfo state_table[] = {
+	{ MAIN_MENU, main_menu_setup, nothing, nothing, main_menu_render, IDLE_TICK_MS, true,
+		"PICK", "", "UP",
+		"", "DOWN",
+		{
+			{ main_menu_pick, nothing, nothing },
+			{ menu_up, nothing, menu_up },
+			{ nothing, nothing, nothing },
+			{ menu_down, nothing, menu_down },
+		} },
+	{ CALIBRATE_1, calibrate_1_setup, calibrate_1_loop, nothing, calibrate_render, TICK_MS, false,
+		"", "CALIBRATING", "",
+		"CANCEL", "",
+		{
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ nothing, go_to_main_menu, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ CALIBRATE_2, calibrate_2_setup, calibrate_2_loop, nothing, calibrate_render, TICK_MS, false,
+		"", "CALIBRATING", "",
+		"CANCEL", "",
+		{
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ nothing, go_to_main_menu, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ CALIBRATE_3, calibrate_3_setup, calibrate_3_loop, nothing, calibrate_render, TICK_MS, false,
+		"", "CALIBRATING", "",
+		"CANCEL", "",
+		{
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ nothing, go_to_main_menu, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ PICK_PROFILE, pick_profile_setup, nothing, nothing, pick_profile_render, IDLE_TICK_MS, true,
+		"PICK", "PROFILE?", "UP",
+		"BACK", "DOWN",
+		{
+			{ pick_profile_pick, nothing, nothing },
+			{ menu_up, nothing, menu_up },
+			{ go_to_main_menu, nothing, nothing },
+			{ menu_down, nothing, menu_down },
+		} },
+	// TODO: use profile name for the title?
+	{ BAKE, bake_run_setup, reflow_loop, bake_exit, bake_render, TICK_MS, false,
+		"", "REFLOWING", "",
+		"CANCEL", "",
+		{
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ go_to_finished_bake, nothing, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ FINISHED_BAKE, finished_bake_setup, nothing, nothing, render_nothing, IDLE_TICK_MS, true,
+		"DONE", "FINISHED", "",
+		"", "",
+		{
+			{ go_to_main_menu, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ go_to_main_menu, nothing, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ FINISHED_CALIBRATE, finished_calibrate_setup, nothing, nothing, render_nothing, IDLE_TICK_MS, true,
+		"DONE", "FINISHED", "",
+		"", "",
+		{
+			{ go_to_main_menu, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ go_to_main_menu, nothing, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ BATCH_IDLE, batch_idle_setup, batch_idle_loop, elements_off, render_nothing, TICK_MS, false,
+		"NEXT", "LOAD BOARDS", "",
+		"STOP", "",
+		{
+			{ go_to_bake, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ go_to_finished_bake, nothing, nothing },
+			{ nothing, nothing, nothing },
+		} },
+	{ FAULT, fault_setup, nothing, nothing, render_nothing, TICK_MS, false,
+		"DONE", "FAULT", "",
+		"", "",
+		{
+			{ clear_safety_fault, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+			{ nothing, nothing, nothing },
+		} },
+};
+
+constexpr bool is_state_table_complete() {
+	for (int i = 0; i < NUM_STATES; i++) {
+		const StateInfo& info = state_table[i];
+		if (info.state != i) return false;
+		if (!info.setup || !info.tick || !info.exit || !info.render) return false;
+		if (info.tick_ms == 0) return false;
+		if (!info.header_left || !info.title || !info.header_right) return false;
+		if (!info.footer_left || !info.footer_right) return false;
+		for (int b = 0; b < NUM_BUTTONS; b++) {
+			for (int e = 0; e < NUM_INPUT_EVENTS; e++) {
+				if (!info.on_input[b][e]) return false;
+			}
+		}
+	}
+	return true;
+}
+static_assert(sizeof(state_table) / sizeof(state_table[0]) == NUM_STATES,
+		"Every state needs an entry in the state table");
+static_assert(is_state_table_complete(),
+		"State table entries must be in State order and handle every event");
+static_assert(IDLE_TICK_MS < SAFETY_STALE_MS,
+		"Idle readings must stay fresh enough to keep feeding the watchdog");
+
+bool is_idle() {
+	return state_table[current_state].idle;
+}
+
+void set_backlight(bool dimmed) {
+	if (dimmed != backlight_dimmed) {
+		backlight_dimmed = dimmed;
+		analogWrite(DISPLAY_BACKLIGHT_EN, dimmed ? BACKLIGHT_DIM : BACKLIGHT_FULL);
+	}
+}
+
+/**
+ * Reports how much of its time in the state core 0 spent awake.
+ */
+void report_duty() {
+	// Nothing to report for the boot screen's first change_state().
+	unsigned long elapsed = millis() - state_start_time;
+	if (state_start_time == 0 || elapsed == 0) return;
+
+	uint64_t awake_us = elapsed * 1000ULL - state_sleep_us;
+	unsigned long permille = (unsigned long) (awake_us * 1000 / (elapsed * 1000ULL));
+	Serial.printf("DUTY: %s awake %lu.%lu%% over %s\n",
+			state_table[current_state].title,
+			permille / 10, permille % 10,
+			get_time_string(elapsed).c_str());
+}
+
+// Core 1's view of the panel. screen_state is the state whose screen is up,
+// or -1 whilst core 0 is still queueing a new one.
+int screen_state = -1;
+bool screen_drawn = false;
+OvenSnapshot drawn_snapshot;
+uint32_t drawn_sequence = 0;
+unsigned long last_frame_time = 0;
+
+void core1_draw_bars(const StateInfo& info, uint16_t color_bg) {
+	uint16_t color_fg = ST77XX_WHITE;
+	int footer_y = 240 - HEADER_FOOTER_SIZE;
+	core1_config(1);
+
+	core1_display.fillRect(0, 0, 320, HEADER_FOOTER_SIZE, color_bg);
+	core1_draw_text(TextType{ 0, 2, color_fg, color_bg, LEFT }, info.header_left);
+	core1_draw_text(TextType{ 320 / 2, 2, color_fg, color_bg, CENTER }, info.title);
+	core1_draw_text(TextType{ 320, 2, color_fg, color_bg, RIGHT }, info.header_right);
+
+	core1_display.fillRect(0, footer_y, 320, HEADER_FOOTER_SIZE, color_bg);
+	core1_draw_text(TextType{ 0, footer_y + 2, color_fg, color_bg, LEFT }, info.footer_left);
+	core1_draw_text(TextType{ 320, footer_y + 2, color_fg, color_bg, RIGHT }, info.footer_right);
+}
+
+void core1_draw_temperature(const OvenSnapshot& now, uint16_t color_bg) {
+	const char *temp_sign = "";
+	if (now.temp != -1 && now.last_temp != -1) {
+		if (now.temp > now.last_temp) temp_sign = "+++";
+		if (now.temp < now.last_temp) temp_sign = "---";
+	}
+
+	// Flag any faulty thermocouples by number.
+	char faults[NUM_THERMOCOUPLES + 2] = "";
+	int num_faults = 0;
+	for (int i = 0; i < NUM_THERMOCOUPLES; i++) {
+		if (now.faults & (1 << i)) {
+			if (num_faults == 0) faults[num_faults++] = '!';
+			faults[num_faults++] = '0' + i;
+		}
+	}
+	faults[num_faults] = '\0';
+
+	char text[DRAW_TEXT_MAX];
+	if (now.temp == -1) {
+		snprintf(text, sizeof(text), "TEMP: ???C %s %s", temp_sign, faults);
+	} else {
+		snprintf(text, sizeof(text), "TEMP: %dC %s %s", now.temp, temp_sign, faults);
+	}
+
+	core1_config(1);
+	core1_draw_text(TextType{ 320 / 2, 240 - HEADER_FOOTER_SIZE + 2, 0xFFFF, color_bg, CENTER }, text);
+}
+
+/**
+ * Brings the panel up to date with the latest snapshot, skipping any that
+ * were published in between.
+ */
+void render_snapshot() {
+	OvenSnapshot now;
+	uint32_t sequence;
+	if (!read_snapshot(now, sequence)) return;
+	drawn_sequence = sequence;
+
+	// Core 0 publishes the new state before queueing its screen.
+	if (now.state != screen_state) return;
+
+	const OvenSnapshot *drawn = screen_drawn ? &drawn_snapshot : NULL;
+	uint16_t color = get_temperature_color(now.temp, now.last_temp);
+	bool recolor = drawn == NULL || color != get_temperature_color(drawn->temp, drawn->last_temp);
+	if (recolor) {
+		core1_draw_bars(state_table[now.state], color);
+	}
+	if (recolor || now.temp != drawn->temp || now.last_temp != drawn->last_temp || now.faults != drawn->faults) {
+		core1_draw_temperature(now, color);
+	}
+	state_table[now.state].render(now, drawn);
+
+	drawn_snapshot = now;
+	screen_drawn = true;
+}
+
+void handle_input() {
+	while (input_tail != input_head) {
+		uint8_t event = input_events[input_tail];
+		input_tail = (input_tail + 1) % INPUT_QUEUE_SIZE;
+		last_input_time = millis();
+		set_backlight(false);
+
+		state_table[current_state].on_input[event >> 2][event & 0x3]();
+	}
+}
+
+/**
+ * Sleeps until the next tick is due, waking early if a button is pressed.
+ * Interrupts are held off between checking and sleeping, so an event can't
+ * slip in between; a pending interrupt still wakes the core, and runs once
+ * they are allowed again.
+ */
+void wait_for_input() {
+	unsigned long tick_ms = state_table[current_state].tick_ms;
+	while (true) {
+		noInterrupts();
+		if (input_tail != input_head || millis() - last_tick_time >= tick_ms) {
+			interrupts();
+			return;
+		}
+		unsigned long sleep_start = micros();
+		__wfi();
+		state_sleep_us += micros() - sleep_start;
+		interrupts();
 	}
 }
 
 void change_state(State new_state) {
+	state_table[current_state].exit();
+	report_duty();
 	current_state = new_state;
+	state_start_time = millis();
+	state_sleep_us = 0;
+	readings_required = !state_table[current_state].idle;
 
-	send_clear();
-	draw_header();
-	draw_footer();
-	text_bg_color = 0x0000;
+	// Anything worth changing screen for is worth seeing.
+	last_input_time = state_start_time;
+	set_backlight(false);
 
 	// Any menu would want to be reset anyway.
-	last_drawn_selection = -1;
 	selection = 0;
 
-	unsigned long current_time = millis();
-	File f;
-	switch (current_state) {
-		case MAIN_MENU:
-			main_menu_setup();
-			break;
-		case PICK_PROFILE:
-			bake_setup();
-			break;
-		case CALIBRATE_1:
-			calibrate_1_setup();
-			break;
-		case CALIBRATE_2:
-			calibrate_2_setup();
-			break;
-		case CALIBRATE_3:
-			calibrate_3_setup();
-			break;
-		case FINISHED_CALIBRATE:
-			finished_calibrate_setup();
-			break;
-		default:
-			break;
-	}
+	// Core 1 draws the header, footer and anything that changes from the
+	// snapshot, once its new screen arrives.
+	send_clear();
+	state_table[current_state].setup();
+	publish_snapshot();
+	send_screen(current_state);
 }
 
 void setup() {
@@ -875,6 +2204,7 @@ void setup() {
 	pinMode(BOTTOM_ELEMENT, OUTPUT);
 	digitalWrite(TOP_ELEMENT, LOW);
 	digitalWrite(BOTTOM_ELEMENT, LOW);
+	boot_mark(BOOT_START);
 
 	// Next set up our multicore comms, then signal to the other core that
 	// it can proceed.
@@ -888,13 +2218,13 @@ void setup() {
 	pinMode(BUTTON_BOTTOM_LEFT, INPUT_PULLUP);
 	pinMode(BUTTON_BOTTOM_RIGHT, INPUT_PULLUP);
 
-	attachInterrupt(digitalPinToInterrupt(BUTTON_TOP_LEFT), top_left_pushed, FALLING);
-	attachInterrupt(digitalPinToInterrupt(BUTTON_TOP_RIGHT), top_right_pushed, FALLING);
-	attachInterrupt(digitalPinToInterrupt(BUTTON_BOTTOM_LEFT), bottom_left_pushed, FALLING);
-	attachInterrupt(digitalPinToInterrupt(BUTTON_BOTTOM_RIGHT), bottom_right_pushed, FALLING);
+	for (int i = 0; i < NUM_BUTTONS; i++) {
+		attachInterrupt(digitalPinToInterrupt(buttons[i].pin), wake_buttons, FALLING);
+	}
+	wake_buttons();
 
 	pinMode(DISPLAY_BACKLIGHT_EN, OUTPUT);
-	digitalWrite(DISPLAY_BACKLIGHT_EN, HIGH);
+	analogWrite(DISPLAY_BACKLIGHT_EN, BACKLIGHT_FULL);
 
 	pinMode(LED_RED, OUTPUT);
 	pinMode(LED_GREEN, OUTPUT);
@@ -903,97 +2233,76 @@ void setup() {
 	digitalWrite(LED_GREEN, HIGH);
 	digitalWrite(LED_BLUE, HIGH);
 
-	bool r = LittleFS.begin();
-	if (!r) {
-		digitalWrite(LED_BLUE, LOW);
-	} else {
-		File f = LittleFS.open("CALIBRATION", "r");
-		if (!f) {
-			digitalWrite(LED_RED, LOW);
-		} else {
-			calibration_cool_lag_time = f.parseInt();
-			calibration_heat_lag_time = f.parseInt();
-			calibration_lag_degrees = f.parseInt();
-			f.close();
-			is_calibrated = true;
-		}
-		LittleFS.end();
-	}
+	Serial.begin();
 
-	change_state(MAIN_MENU);
+	load_settings();
+	boot_mark(BOOT_SETTINGS_LOADED);
 
-	// Init the temperature sensor whilst we wait for the initial screen draw.
-	for (int i = 0; i < 5; i++) {
+	// Init the temperature sensor whilst the other core brings up the
+	// display. We only need two good readings for the temperature colour.
+	for (int i = 0; i < 5 && (current_temp == -1 || last_temp == -1); i++) {
 		delay(100);
 		update_temperature();
 	}
+	boot_mark(BOOT_SENSOR_READY);
+
+	change_state(MAIN_MENU);
+	send_mark(BOOT_FIRST_SCREEN);
+
+	start_supervisor();
 }
 
 void loop() {
-	update_temperature();
+	if (!boot_reported && boot_marks[BOOT_FIRST_SCREEN] != 0) {
+		// Core 1 has drawn the first screen, so it is safe to park it.
+		if (settings_need_flash) {
+			write_flash_settings();
+			settings_need_flash = false;
+		}
+		report_boot();
+		boot_reported = true;
+	}
+
+	// Button presses wake us between ticks, but the temperature is only read
+	// once per tick.
+	unsigned long current_time = millis();
+	if (current_time - last_tick_time >= state_table[current_state].tick_ms) {
+		last_tick_time = current_time;
+		update_temperature();
 
-	uint16_t temp_color = get_temperature_color();
-	if (temp_color != current_temp_color) {
-		current_temp_color = temp_color;
-		draw_header();
-		draw_footer();
-	} else if (last_temp != current_temp){
-		draw_temperature();
+		if (is_idle() && current_time - last_input_time >= BACKLIGHT_DIM_MS) {
+			set_backlight(true);
+		}
 	}
 
-	text_bg_color = 0x0000;
+	handle_input();
+	state_table[current_state].tick();
 
-	int delay_ms = 100;
-	switch (current_state) {
-		case MAIN_MENU:
-			main_menu_loop();
-			break;
-		case CALIBRATE_1:
-			calibrate_1_loop();
-			break;
-		case CALIBRATE_2:
-			calibrate_2_loop();
-			break;
-		case CALIBRATE_3:
-			calibrate_3_loop();
-			break;
-		case PICK_PROFILE:
-			break;
-		case BAKE:
-			break;
-		case FINISHED_BAKE:
-			break;
-		case FINISHED_CALIBRATE:
-			break;
+	// Last, so that nothing input or the tick did can take us anywhere else.
+	if (safety_fault != SAFETY_OK && current_state != FAULT) {
+		next_state = FAULT;
 	}
+	publish_snapshot();
 
 	if (next_state != current_state) {
 		change_state(next_state);
 	} else {
-		delay(delay_ms);
+		wait_for_input();
 	}
 }
 
 /** SECOND CORE **/
-Adafruit_ST7789 core1_display = Adafruit_ST7789(DISPLAY_CS, DISPLAY_DC, DISPLAY_MOSI, DISPLAY_SCLK);
-
-void core1_draw_text(const TextType& text, const string& actual_text) {
-	auto str = actual_text.c_str();
-
-	int16_t x, y;
-	uint16_t w, h;
-	core1_display.getTextBounds(str, 0, 0, &x, &y, &w, &h);
-
-	x = text.x;
-	y = text.y;
-
-	if (text.justify == CENTER) x -= w / 2;
-	if (text.justify == RIGHT) x -= w;
-
-	core1_display.setTextColor(text.fg_color);
-	core1_display.fillRect(x, y, w, h, text.bg_color);
-	core1_display.setCursor(x, y);
-	core1_display.print(str);
+/**
+ * Streams an asset to the panel in a single transaction, one run at a time.
+ */
+void core1_blit(const Asset *asset) {
+	core1_display.startWrite();
+	core1_display.setAddrWindow(asset->x, asset->y, asset->width, asset->height);
+	for (uint32_t i = 0; i < asset->num_runs; i++) {
+		uint16_t run = asset->runs[i];
+		core1_display.writeColor(asset->palette[ASSET_RUN_INDEX(run)], ASSET_RUN_LENGTH(run));
+	}
+	core1_display.endWrite();
 }
 
 void setup1() {
@@ -1004,24 +2313,23 @@ void setup1() {
 	core1_display.setFont();
 	core1_display.setTextSize(2);
 	core1_display.setTextColor(ST77XX_WHITE);
+	boot_marks[BOOT_DISPLAY_READY] = millis();
 
 	// Wait for the other core to signal us before starting our loop.
 	rp2040.fifo.pop();
 }
 
-void loop1() {
-	DrawMessage message{DrawMessage::CLEAR, { NoArgsType{} }};
-	queue_remove_blocking(&drawing_queue, &message);
-
-	string copied_text;
-	if (message.str != nullptr) {
-		copied_text = *message.str;
-		delete message.str;
-	}
-
+void core1_handle_message(const DrawMessage& message) {
 	switch (message.type) {
 		case DrawMessage::CLEAR:
 			core1_display.fillScreen(0x0000);
+			screen_state = -1;
+			break;
+		case DrawMessage::SCREEN:
+			screen_state = message.screen.state;
+			screen_drawn = false;
+			render_snapshot();
+			last_frame_time = millis();
 			break;
 		case DrawMessage::RECT:
 			core1_display.fillRect(
@@ -1037,10 +2345,10 @@ void loop1() {
 					message.cursor.y);
 			break;
 		case DrawMessage::PRINT:
-			core1_display.print(copied_text.c_str());
+			core1_display.print(message.str);
 			break;
 		case DrawMessage::TEXT:
-			core1_draw_text(message.text, copied_text);
+			core1_draw_text(message.text, message.str);
 			break;
 		case DrawMessage::CONFIG:
 			core1_display.setTextSize(message.config.textSize);
@@ -1061,7 +2369,39 @@ void loop1() {
 					message.pixel.y,
 					message.pixel.color);
 			break;
+		case DrawMessage::MARK:
+			boot_marks[message.mark.index] = millis();
+			break;
+		case DrawMessage::BLIT:
+			core1_blit(message.blit.asset);
+			break;
 		default:
 			break;
 	}
 }
+
+void loop1() {
+	DrawMessage message{DrawMessage::CLEAR, { NoArgsType{} }};
+	if (queue_try_remove(&drawing_queue, &message)) {
+		core1_handle_message(message);
+		return;
+	}
+
+	// Both queueing a message and publishing a snapshot signal an event, so
+	// sleep on WFE until there is something new to draw.
+	bool stale = screen_state != -1 && (!screen_drawn || snapshot_sequence != drawn_sequence);
+	if (!stale) {
+		__wfe();
+		return;
+	}
+
+	// Draw no more than once a frame. Snapshots published in between are
+	// skipped, only the latest matters.
+	unsigned long since_frame = millis() - last_frame_time;
+	if (since_frame < FRAME_MS) {
+		best_effort_wfe_or_timeout(make_timeout_time_ms(FRAME_MS - since_frame));
+		return;
+	}
+	render_snapshot();
+	last_frame_time = millis();
+}
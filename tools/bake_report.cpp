@@ -0,0 +1,406 @@
+/**
+ * Computes quality metrics for an archive of bake logs, and judges each bake
+ * against the firmware's reflow profile.
+ *
+ * Logs are either CSV, with one "time_ms,temperature,setpoint,phase" sample
+ * per line where phase is the firmware's ReflowState, or the compact binary
+ * form written by --to-binary. Binary logs start with BINARY_MAGIC and hold
+ * packed BinarySample records.
+ *
+ * Samples are read a block at a time into flat arrays, and each metric is a
+ * single pass over the block with no branches, so the compiler can vectorise
+ * them. Files are processed in parallel on threads, as analysing a log only
+ * reads the profile from the firmware and never drives it.
+ *
+ * Usage: bake_report [--option=value ...] [--to-binary] log...
+ */
+
+#include "host/firmware.h"
+#include "host/options.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define BLOCK_SIZE (4096)
+// Ramp rates are measured across this many samples, to see past the
+// thermocouple's quantisation.
+#define RAMP_LAG (10)
+
+const char BINARY_MAGIC[8] = { 'O', 'V', 'E', 'N', 'L', 'O', 'G', '1' };
+
+class __attribute__((packed)) BinarySample {
+	public:
+		uint32_t time;
+		int16_t temp;      // Tenths of a degree.
+		int16_t setpoint;  // Tenths of a degree.
+		uint8_t phase;
+};
+
+class Options {
+	public:
+		float liquidus = 217;
+		float tal_min = 30;
+		float tal_max = 90;
+		float max_ramp = 3;
+		float peak_margin = 10;
+		float max_rms_error = 10;
+		int jobs = 8;
+		bool to_binary = false;
+		const char *profile = nullptr;
+};
+
+/**
+ * One block of samples. The first RAMP_LAG entries of each array carry over
+ * the end of the previous block.
+ */
+class Block {
+	public:
+		float time[RAMP_LAG + BLOCK_SIZE];
+		float temp[RAMP_LAG + BLOCK_SIZE];
+		float setpoint[RAMP_LAG + BLOCK_SIZE];
+		uint8_t phase[RAMP_LAG + BLOCK_SIZE];
+		int count = 0;
+		int history = 0;
+		// Times are kept relative to the first sample, to fit in a float.
+		unsigned long start_time = 0;
+		bool started = false;
+
+		float get_time(unsigned long t) {
+			if (!started) {
+				start_time = t;
+				started = true;
+			}
+			return t - start_time;
+		}
+
+		float *new_time() { return time + RAMP_LAG; }
+		float *new_temp() { return temp + RAMP_LAG; }
+		float *new_setpoint() { return setpoint + RAMP_LAG; }
+		uint8_t *new_phase() { return phase + RAMP_LAG; }
+
+		void carry_over() {
+			int keep = count + history < RAMP_LAG ? count + history : RAMP_LAG;
+			int from = RAMP_LAG + count - keep;
+			memmove(time + RAMP_LAG - keep, time + from, keep * sizeof(float));
+			memmove(temp + RAMP_LAG - keep, temp + from, keep * sizeof(float));
+			memmove(setpoint + RAMP_LAG - keep, setpoint + from, keep * sizeof(float));
+			memmove(phase + RAMP_LAG - keep, phase + from, keep);
+			history = keep;
+			count = 0;
+		}
+};
+
+class BakeMetrics {
+	public:
+		unsigned long samples = 0;
+		float start_time = 0;
+		float end_time = 0;
+		float peak = -1000;
+		float time_above_liquidus = 0;
+		float max_ramp = 0;
+		float soak_time = 0;
+		double tracking_error_squared = 0;
+		float tracking_time = 0;
+
+		float get_rms_error() const {
+			return tracking_time > 0 ? sqrt(tracking_error_squared / tracking_time) : 0;
+		}
+};
+
+enum Verdict {
+	VERDICT_PASS,
+	VERDICT_FAIL,
+	VERDICT_ERROR
+};
+
+class Report {
+	public:
+		Verdict verdict = VERDICT_ERROR;
+		BakeMetrics metrics;
+		string reasons;
+};
+
+/**
+ * Folds one block into the metrics. Time-weighted sums use the gap since the
+ * previous sample, so uneven sampling is handled.
+ */
+void process_block(Block& block, BakeMetrics& m, const Options& options) {
+	int n = block.count;
+	if (n == 0) return;
+
+	const float *time = block.new_time();
+	const float *temp = block.new_temp();
+	const float *setpoint = block.new_setpoint();
+	const uint8_t *phase = block.new_phase();
+
+	// Before the first sample there is no gap to weight by.
+	if (block.history == 0) block.time[RAMP_LAG - 1] = time[0];
+
+	float peak = m.peak;
+	float above = 0;
+	float soak = 0;
+	float error_squared = 0;
+	float tracked = 0;
+	for (int i = 0; i < n; i++) {
+		float dt = time[i] - time[i - 1];
+		float error = temp[i] - setpoint[i];
+		float is_tracking = (phase[i] == SOAK || phase[i] == REFLOW) ? dt : 0;
+
+		peak = temp[i] > peak ? temp[i] : peak;
+		above += temp[i] >= options.liquidus ? dt : 0;
+		soak += phase[i] == SOAK ? dt : 0;
+		error_squared += error * error * is_tracking;
+		tracked += is_tracking;
+	}
+
+	// Ramp rate across RAMP_LAG samples, reaching back into the history.
+	float max_ramp = m.max_ramp;
+	int first = block.history < RAMP_LAG ? RAMP_LAG - block.history : 0;
+	for (int i = first; i < n; i++) {
+		float span = block.time[i + RAMP_LAG] - block.time[i];
+		float ramp = (block.temp[i + RAMP_LAG] - block.temp[i]) * 1000 / (span > 0 ? span : 1);
+		max_ramp = ramp > max_ramp ? ramp : max_ramp;
+	}
+
+	if (m.samples == 0) m.start_time = time[0];
+	m.samples += n;
+	m.end_time = time[n - 1];
+	m.peak = peak;
+	m.max_ramp = max_ramp;
+	m.time_above_liquidus += above / 1000;
+	m.soak_time += soak / 1000;
+	m.tracking_error_squared += error_squared / 1000;
+	m.tracking_time += tracked / 1000;
+
+	block.carry_over();
+}
+
+/**
+ * Parses one "time_ms,temperature,setpoint,phase" line. This is a lot quicker
+ * than sscanf, which dominates the time spent on CSV logs otherwise.
+ */
+bool parse_line(const char *line, unsigned long *time, float *temp, float *setpoint, int *phase) {
+	char *end;
+	*time = strtoul(line, &end, 10);
+	if (end == line || *end != ',') return false;
+	line = end + 1;
+	*temp = strtof(line, &end);
+	if (end == line || *end != ',') return false;
+	line = end + 1;
+	*setpoint = strtof(line, &end);
+	if (end == line || *end != ',') return false;
+	line = end + 1;
+	*phase = strtol(line, &end, 10);
+	return end != line && *phase >= PREHEAT && *phase <= COOL;
+}
+
+bool is_binary(FILE *file) {
+	char magic[sizeof(BINARY_MAGIC)];
+	bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+		&& memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+	if (!binary) rewind(file);
+	return binary;
+}
+
+/**
+ * Fills the block with the next samples from the file. Returns false once
+ * there are no more.
+ */
+bool read_block(FILE *file, bool binary, Block& block) {
+	float *time = block.new_time();
+	float *temp = block.new_temp();
+	float *setpoint = block.new_setpoint();
+	uint8_t *phase = block.new_phase();
+
+	if (binary) {
+		static thread_local BinarySample samples[BLOCK_SIZE];
+		size_t n = fread(samples, sizeof(BinarySample), BLOCK_SIZE, file);
+		for (size_t i = 0; i < n; i++) {
+			time[i] = block.get_time(samples[i].time);
+			temp[i] = samples[i].temp / 10.0f;
+			setpoint[i] = samples[i].setpoint / 10.0f;
+			phase[i] = samples[i].phase;
+		}
+		block.count = n;
+		return n > 0;
+	}
+
+	char line[128];
+	int n = 0;
+	while (n < BLOCK_SIZE && fgets(line, sizeof(line), file) != nullptr) {
+		unsigned long t;
+		float value, target;
+		int p;
+		if (!parse_line(line, &t, &value, &target, &p)) continue;
+		time[n] = block.get_time(t);
+		temp[n] = value;
+		setpoint[n] = target;
+		phase[n] = p;
+		n++;
+	}
+	block.count = n;
+	return n > 0;
+}
+
+void judge(Report& report, const Options& options) {
+	const BakeMetrics& m = report.metrics;
+	auto fail = [&](const char *reason) {
+		report.verdict = VERDICT_FAIL;
+		report.reasons += reason;
+	};
+
+	report.verdict = VERDICT_PASS;
+	if (m.peak < reflow_temp - options.peak_margin) fail(" peak-low");
+	if (m.peak > reflow_temp + options.peak_margin) fail(" peak-high");
+	if (m.time_above_liquidus < options.tal_min) fail(" tal-short");
+	if (m.time_above_liquidus > options.tal_max) fail(" tal-long");
+	if (m.max_ramp > options.max_ramp) fail(" ramp");
+	if (m.soak_time < soak_duration / 1000.0f) fail(" soak-short");
+	if (m.get_rms_error() > options.max_rms_error) fail(" tracking");
+}
+
+Report analyse(const char *path, const Options& options) {
+	Report report;
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		report.reasons = " unreadable";
+		return report;
+	}
+
+	bool binary = is_binary(file);
+	static thread_local Block block;
+	block.count = 0;
+	block.history = 0;
+	block.started = false;
+	while (read_block(file, binary, block)) {
+		process_block(block, report.metrics, options);
+	}
+	fclose(file);
+
+	if (report.metrics.samples == 0) {
+		report.reasons = " empty";
+		return report;
+	}
+	judge(report, options);
+	return report;
+}
+
+bool convert_to_binary(const char *path) {
+	FILE *in = fopen(path, "r");
+	string out_path = string(path) + ".bin";
+	FILE *out = fopen(out_path.c_str(), "wb");
+	if (in == nullptr || out == nullptr) {
+		if (in) fclose(in);
+		if (out) fclose(out);
+		return false;
+	}
+
+	fwrite(BINARY_MAGIC, 1, sizeof(BINARY_MAGIC), out);
+	char line[128];
+	while (fgets(line, sizeof(line), in) != nullptr) {
+		unsigned long t;
+		float value, target;
+		int p;
+		if (!parse_line(line, &t, &value, &target, &p)) continue;
+		BinarySample sample{
+			(uint32_t) t,
+			(int16_t) lround(value * 10),
+			(int16_t) lround(target * 10),
+			(uint8_t) p
+		};
+		fwrite(&sample, sizeof(sample), 1, out);
+	}
+	fclose(in);
+	fclose(out);
+	return true;
+}
+
+/**
+ * Reads a PROFILE file, in the same order as load_profile() in the firmware.
+ */
+bool read_profile(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == nullptr) return false;
+	int values[7];
+	bool ok = true;
+	for (int i = 0; i < 7; i++) {
+		ok = ok && fscanf(file, "%d", &values[i]) == 1;
+	}
+	fclose(file);
+	if (!ok) return false;
+
+	preheat_temp = values[0];
+	preheat_duration = values[1];
+	soak_temp = values[2];
+	soak_duration = values[3];
+	reflow_temp = values[4];
+	reflow_duration = values[5];
+	cool_duration = values[6];
+	return true;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	std::vector<const char *> paths;
+	OptionParser parser;
+	parser.add_flag("to-binary", &options.to_binary);
+	parser.add("profile", &options.profile);
+	parser.add("jobs", &options.jobs);
+	parser.add("liquidus", &options.liquidus);
+	parser.add("tal-min", &options.tal_min);
+	parser.add("tal-max", &options.tal_max);
+	parser.add("max-ramp", &options.max_ramp);
+	parser.add("peak-margin", &options.peak_margin);
+	parser.add("max-rms-error", &options.max_rms_error);
+	if (!parser.parse(argc, argv, &paths)) {
+		return 1;
+	}
+	if (options.jobs < 1) options.jobs = 1;
+	if (options.profile != nullptr && !read_profile(options.profile)) {
+		fprintf(stderr, "Couldn't read profile %s\n", options.profile);
+		return 1;
+	}
+
+	std::vector<Report> reports(paths.size());
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> workers;
+	for (int i = 0; i < options.jobs; i++) {
+		workers.emplace_back([&] {
+			for (size_t j = next++; j < paths.size(); j = next++) {
+				if (options.to_binary) {
+					reports[j].verdict = convert_to_binary(paths[j]) ? VERDICT_PASS : VERDICT_ERROR;
+				} else {
+					reports[j] = analyse(paths[j], options);
+				}
+			}
+		});
+	}
+	for (auto& worker : workers) worker.join();
+
+	int counts[3] = {0};
+	if (!options.to_binary) {
+		printf("log,verdict,peak,tal_s,duration_s,max_ramp,soak_s,rms_error,reasons\n");
+	}
+	for (size_t i = 0; i < paths.size(); i++) {
+		const Report& r = reports[i];
+		counts[r.verdict]++;
+		if (options.to_binary) continue;
+
+		const BakeMetrics& m = r.metrics;
+		printf("%s,%s,%.1f,%.0f,%.0f,%.2f,%.0f,%.2f,%s\n",
+				paths[i],
+				r.verdict == VERDICT_PASS ? "PASS" : r.verdict == VERDICT_FAIL ? "FAIL" : "ERROR",
+				m.peak,
+				m.time_above_liquidus,
+				(m.end_time - m.start_time) / 1000,
+				m.max_ramp,
+				m.soak_time,
+				m.get_rms_error(),
+				r.reasons.c_str());
+	}
+
+	fprintf(stderr, "%zu bakes: %d passed, %d failed, %d unreadable\n",
+			paths.size(), counts[VERDICT_PASS], counts[VERDICT_FAIL], counts[VERDICT_ERROR]);
+	return counts[VERDICT_PASS] == (int) paths.size() ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+/**
+ * Micro-benchmarks for the firmware's hot paths, built against the host
+ * stand-ins, and a gate against the checked-in baseline.
+ *
+ * Each benchmark reports nanoseconds, heap allocations and, where the kernel
+ * allows perf_event, instructions per operation. Times are the best of many
+ * short batches, and are also taken relative to a fixed reference workload
+ * timed alongside, which cancels out how fast the machine happens to be.
+ * Instruction counts are gated on whenever both runs have them, and relative
+ * times otherwise. Even relative times move by tens of percent between runs
+ * on a busy or virtual machine, so they get a looser threshold of their own.
+ * Any new heap allocation is a regression, whatever the threshold.
+ *
+ * Usage: bench [--baseline=FILE] [--threshold=PERCENT]
+ *     [--time-threshold=PERCENT] [--update]
+ */
+
+#include "host/firmware.h"
+#include "host/options.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/personality.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#define BATCH_NS (2'000'000)
+#define REPEATS (15)
+// A benchmark that looks to have regressed is measured again, in case the
+// machine was just busy.
+#define ATTEMPTS (3)
+// How fast this machine runs drifts over seconds, so a baseline's runs are
+// spread out rather than taken back to back.
+#define BASELINE_RUNS (9)
+#define BASELINE_GAP_MS (1000)
+
+// Every operator new in the process goes through here, so the firmware's
+// strings count as well as anything else.
+unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+/**
+ * Stops the compiler from optimising away a result.
+ */
+template <class T>
+inline void keep(const T& value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+class InstructionCounter {
+	public:
+		int fd = -1;
+
+		bool open() {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+			return fd >= 0;
+		}
+
+		void start() {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+
+		uint64_t stop() {
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			uint64_t count = 0;
+			if (read(fd, &count, sizeof(count)) != sizeof(count)) return 0;
+			return count;
+		}
+};
+
+// ** BENCHMARKS ** //
+
+unsigned long bench_time = 0;
+
+void bench_desired_temperature() {
+	bench_time = (bench_time + 977) % 90'000;
+	keep(get_desired_temperature(REFLOW, bench_time));
+}
+
+void bench_time_string() {
+	bench_time = (bench_time + 977) % 3'600'000;
+	string text = get_time_string(bench_time);
+	keep(text);
+}
+
+OvenSnapshot get_bench_snapshot() {
+	OvenSnapshot now;
+	memset(&now, 0, sizeof(now));
+	now.state = BAKE;
+	now.reflow_state = COOL;
+	now.temp = 213;
+	now.last_temp = 215;
+	now.setpoint = 210;
+	now.faults = 0x2;
+	now.cooling = COOLING_COUNTDOWN;
+	now.state_time = 250'000;
+	now.door_countdown = 42'000;
+	return now;
+}
+
+void bench_draw_temperature() {
+	static OvenSnapshot now = get_bench_snapshot();
+	core1_draw_temperature(now, 0x8082);
+}
+
+void bench_bake_render() {
+	static OvenSnapshot now = get_bench_snapshot();
+	bake_render(now, nullptr);
+}
+
+// Message benchmarks work on a burst of the kinds of message a state's setup
+// sends, rather than one at a time, which is too quick to time reliably.
+
+void send_message_burst() {
+	send_config(2);
+	send_text("RUN 1/1", 320 / 2, 40, CENTER);
+	send_rect(0, 0, 320, HEADER_FOOTER_SIZE, 0x8082);
+	send_line(19, 221, 301, 221, 0xF000);
+	send_pixel(20, 200, 0xFFFF);
+	send_print("RUNS DONE: ", 0, 40);
+}
+
+void bench_message_encode() {
+	send_message_burst();
+}
+
+void bench_message_decode() {
+	static std::vector<DrawMessage> burst = [] {
+		// The host queue keeps only the last message, so catch each as it
+		// is sent.
+		std::vector<DrawMessage> messages;
+		auto take = [&] {
+			DrawMessage message{ DrawMessage::CLEAR, { NoArgsType{} } };
+			memcpy((void *) &message, drawing_queue.last, sizeof(message));
+			messages.push_back(message);
+		};
+		send_config(2); take();
+		send_text("RUN 1/1", 320 / 2, 40, CENTER); take();
+		send_rect(0, 0, 320, HEADER_FOOTER_SIZE, 0x8082); take();
+		send_line(19, 221, 301, 221, 0xF000); take();
+		send_pixel(20, 200, 0xFFFF); take();
+		send_print("RUNS DONE: "); take();
+		return messages;
+	}();
+	for (const DrawMessage& message : burst) {
+		core1_handle_message(message);
+	}
+}
+
+void bench_profile_curve() {
+	bake_setup();
+}
+
+/**
+ * A fixed amount of plain integer work, to time the machine against.
+ */
+void bench_reference() {
+	static uint32_t state = 1;
+	for (int i = 0; i < 100; i++) state = state * 1'664'525u + 1'013'904'223u;
+	keep(state);
+}
+
+class Benchmark {
+	public:
+		const char *name;
+		void (*run)();
+};
+
+const Benchmark reference = { "reference", bench_reference };
+
+const Benchmark benchmarks[] = {
+	{ "get_desired_temperature", bench_desired_temperature },
+	{ "get_time_string", bench_time_string },
+	{ "draw_temperature", bench_draw_temperature },
+	{ "bake_render", bench_bake_render },
+	{ "message_encode", bench_message_encode },
+	{ "message_decode", bench_message_decode },
+	{ "profile_curve", bench_profile_curve },
+};
+
+// ** MEASUREMENT ** //
+
+class Measurement {
+	public:
+		string name;
+		double ns = NAN;
+		// Time taken relative to the reference workload.
+		double relative = NAN;
+		double allocations = NAN;
+		// NaN where perf_event isn't available.
+		double instructions = NAN;
+};
+
+uint64_t get_ns() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1'000'000'000ULL + now.tv_nsec;
+}
+
+uint64_t time_batch(void (*run)(), unsigned long iterations) {
+	uint64_t start = get_ns();
+	for (unsigned long i = 0; i < iterations; i++) run();
+	return get_ns() - start;
+}
+
+unsigned long get_batch_size(void (*run)()) {
+	unsigned long iterations = 1;
+	while (time_batch(run, iterations) < BATCH_NS) iterations *= 2;
+	return iterations;
+}
+
+Measurement measure(const Benchmark& benchmark, InstructionCounter *counter) {
+	Measurement m;
+	m.name = benchmark.name;
+
+	// Warm up, and size the batches to take a while each.
+	unsigned long iterations = get_batch_size(benchmark.run);
+	unsigned long reference_iterations = get_batch_size(reference.run);
+
+	// Each batch is timed next to a batch of the reference, so that both see
+	// the machine in the same mood.
+	double reference_ns = NAN;
+	for (int i = 0; i < REPEATS; i++) {
+		double ns = (double) time_batch(benchmark.run, iterations) / iterations;
+		if (isnan(m.ns) || ns < m.ns) m.ns = ns;
+		ns = (double) time_batch(reference.run, reference_iterations) / reference_iterations;
+		if (isnan(reference_ns) || ns < reference_ns) reference_ns = ns;
+	}
+	m.relative = m.ns / reference_ns;
+
+	unsigned long before = allocations;
+	time_batch(benchmark.run, iterations);
+	m.allocations = (double) (allocations - before) / iterations;
+
+	if (counter != nullptr) {
+		counter->start();
+		time_batch(benchmark.run, iterations);
+		m.instructions = (double) counter->stop() / iterations;
+	}
+	return m;
+}
+
+// ** BASELINE ** //
+
+std::vector<Measurement> read_baseline(const char *path) {
+	std::vector<Measurement> baseline;
+	FILE *file = fopen(path, "r");
+	if (file == nullptr) return baseline;
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		if (line[0] == '#' || strncmp(line, "name,", 5) == 0) continue;
+		char name[64], instructions[32];
+		Measurement m;
+		if (sscanf(line, "%63[^,],%lf,%lf,%lf,%31s", name, &m.ns, &m.relative, &m.allocations, instructions) != 5) {
+			continue;
+		}
+		m.name = name;
+		m.instructions = strcmp(instructions, "-") == 0 ? NAN : atof(instructions);
+		baseline.push_back(m);
+	}
+	fclose(file);
+	return baseline;
+}
+
+bool write_baseline(const char *path, const std::vector<Measurement>& results) {
+	FILE *file = fopen(path, "w");
+	if (file == nullptr) {
+		perror(path);
+		return false;
+	}
+	fprintf(file, "# Written by bench --update. Times are from the machine that wrote it.\n");
+	fprintf(file, "name,ns_per_op,relative_time,allocations_per_op,instructions_per_op\n");
+	for (const Measurement& m : results) {
+		fprintf(file, "%s,%.1f,%.3f,%.2f,", m.name.c_str(), m.ns, m.relative, m.allocations);
+		if (isnan(m.instructions)) {
+			fprintf(file, "-\n");
+		} else {
+			fprintf(file, "%.0f\n", m.instructions);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+const Measurement *find_measurement(const std::vector<Measurement>& list, const string& name) {
+	for (const Measurement& m : list) {
+		if (m.name == name) return &m;
+	}
+	return nullptr;
+}
+
+int main(int argc, char **argv) {
+	// Address randomisation moves code and data about between runs, which
+	// alone can shift times by more than the threshold, so run without it.
+	int persona = personality(0xFFFFFFFF);
+	if (persona != -1 && !(persona & ADDR_NO_RANDOMIZE)
+			&& personality(persona | ADDR_NO_RANDOMIZE) != -1) {
+		execv("/proc/self/exe", argv);
+	}
+
+	const char *baseline_path = "tools/bench_baseline.csv";
+	float threshold = 10;
+	float time_threshold = 50;
+	bool update = false;
+	OptionParser parser;
+	parser.add("baseline", &baseline_path);
+	parser.add("threshold", &threshold);
+	parser.add("time-threshold", &time_threshold);
+	parser.add_flag("update", &update);
+	if (!parser.parse(argc, argv)) {
+		return 1;
+	}
+
+	firmware_boot(ThermalModel::from_calibration(20'000, 10'000, 15), 15, 25);
+	current_temp = last_temp = 25;
+
+	InstructionCounter counter;
+	bool have_counter = counter.open();
+	if (!have_counter) {
+		fprintf(stderr, "perf_event isn't available, so gating on time.\n");
+	}
+
+	// A baseline takes the middle of several rounds through every benchmark,
+	// so that it isn't set by one lucky or unlucky stretch.
+	int runs = update ? BASELINE_RUNS : 1;
+	std::vector<std::vector<Measurement>> runs_of(std::size(benchmarks));
+	for (int i = 0; i < runs; i++) {
+		if (i > 0) usleep(BASELINE_GAP_MS * 1000);
+		for (size_t b = 0; b < std::size(benchmarks); b++) {
+			runs_of[b].push_back(measure(benchmarks[b], have_counter ? &counter : nullptr));
+		}
+	}
+	std::vector<Measurement> results;
+	for (auto& measurements : runs_of) {
+		std::sort(measurements.begin(), measurements.end(), [](const Measurement& a, const Measurement& b) {
+			return a.relative < b.relative;
+		});
+		results.push_back(measurements[runs / 2]);
+	}
+
+	if (update) {
+		return write_baseline(baseline_path, results) ? 0 : 1;
+	}
+
+	std::vector<Measurement> baseline = read_baseline(baseline_path);
+	int regressions = 0;
+	printf("%-24s %10s %10s %12s  %s\n", "", "ns/op", "allocs/op", "instrs/op", "vs baseline");
+	for (size_t b = 0; b < results.size(); b++) {
+		Measurement& m = results[b];
+		const Measurement *base = find_measurement(baseline, m.name);
+		double change = 0;
+		bool by_instructions = false;
+		bool regressed = false;
+		for (int attempt = 0; base != nullptr; attempt++) {
+			by_instructions = !isnan(m.instructions) && !isnan(base->instructions);
+			double now = by_instructions ? m.instructions : m.relative;
+			double then = by_instructions ? base->instructions : base->relative;
+			change = then > 0 ? 100 * (now - then) / then : 0;
+			regressed = change > (by_instructions ? threshold : time_threshold)
+				|| m.allocations > base->allocations + 0.005;
+			if (!regressed || attempt + 1 == ATTEMPTS) break;
+
+			Measurement again = measure(benchmarks[b], have_counter ? &counter : nullptr);
+			if (again.relative < m.relative) m = again;
+		}
+
+		char instructions[32] = "-";
+		if (!isnan(m.instructions)) snprintf(instructions, sizeof(instructions), "%.0f", m.instructions);
+		char verdict[64] = "new";
+		if (base != nullptr) {
+			snprintf(verdict, sizeof(verdict), "%+.1f%% %s%s",
+					change,
+					by_instructions ? "instrs" : "time",
+					regressed ? ", REGRESSED" : "");
+		}
+		if (regressed) regressions++;
+
+		printf("%-24s %10.1f %10.2f %12s  %s\n", m.name.c_str(), m.ns, m.allocations, instructions, verdict);
+	}
+
+	if (regressions > 0) {
+		fprintf(stderr, "%d benchmarks regressed past the threshold or started allocating.\n", regressions);
+		return 1;
+	}
+	return 0;
+}
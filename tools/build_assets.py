@@ -0,0 +1,156 @@
+"""
+Rasterises static screen elements into RLE compressed RGB565 assets, so the
+display core can stream them to the panel in one transfer instead of drawing
+them glyph by glyph.
+
+PlatformIO loads this as a pre: extra script. Library dependencies aren't
+installed until later, so it only adds a step that runs just before main.cpp
+is compiled, which finds the fonts in the installed Adafruit GFX library and
+writes assets.h into the build directory. It can also be run by hand:
+
+    python tools/build_assets.py <font directory> <output header>
+"""
+
+import os
+import re
+import sys
+
+# Each asset is text drawn the same way Adafruit_GFX prints with a custom
+# font: the cursor is the baseline, and newlines return to x = 0.
+ASSETS = [
+    {
+        "name": "splash",
+        "font": "FreeSerif18pt7b",
+        "text": "NEON\nGENESIS\nOVENGELION",
+        "cursor": (0, 50),
+        "fg": 0xFFFF,
+        "bg": 0x0000,
+    },
+]
+
+MAX_RUN = 0x7FFF
+
+
+def load_font(font_dir, name):
+    with open(os.path.join(font_dir, name + ".h")) as f:
+        source = f.read()
+
+    bitmap_source = re.search(r"Bitmaps\[\][^{]*{(.*?)}", source, re.S).group(1)
+    bitmaps = [int(value, 16) for value in re.findall(r"0x[0-9A-Fa-f]+", bitmap_source)]
+
+    glyph_source = re.search(r"Glyphs\[\][^{]*{(.*?)};", source, re.S).group(1)
+    glyphs = [
+        tuple(int(value) for value in match)
+        for match in re.findall(r"{\s*(-?\d+),\s*(-?\d+),\s*(-?\d+),\s*(-?\d+),\s*(-?\d+),\s*(-?\d+)\s*}", glyph_source)
+    ]
+
+    font_source = re.search(r"GFXfont\s+" + name + r"[^{]*{(.*?)}", source, re.S).group(1)
+    first, last, y_advance = [int(value, 0) for value in font_source.split(",")[2:5]]
+
+    return {"bitmaps": bitmaps, "glyphs": glyphs, "first": first, "last": last, "y_advance": y_advance}
+
+
+def render_text(font, text, cursor):
+    pixels = set()
+    x, y = cursor
+    for char in text:
+        if char == "\n":
+            x = 0
+            y += font["y_advance"]
+            continue
+        code = ord(char)
+        if code < font["first"] or code > font["last"]:
+            continue
+
+        offset, width, height, x_advance, x_offset, y_offset = font["glyphs"][code - font["first"]]
+        bit = 0
+        for yy in range(height):
+            for xx in range(width):
+                byte = font["bitmaps"][offset + bit // 8]
+                if byte & (0x80 >> (bit % 8)):
+                    pixels.add((x + x_offset + xx, y + y_offset + yy))
+                bit += 1
+        x += x_advance
+    return pixels
+
+
+def encode(pixels):
+    min_x = min(p[0] for p in pixels)
+    min_y = min(p[1] for p in pixels)
+    width = max(p[0] for p in pixels) - min_x + 1
+    height = max(p[1] for p in pixels) - min_y + 1
+
+    runs = []
+    index, length = 0, 0
+    for y in range(min_y, min_y + height):
+        for x in range(min_x, min_x + width):
+            pixel = 1 if (x, y) in pixels else 0
+            if pixel != index or length == MAX_RUN:
+                if length:
+                    runs.append((index << 15) | length)
+                index, length = pixel, 0
+            length += 1
+    runs.append((index << 15) | length)
+
+    return min_x, min_y, width, height, runs
+
+
+def generate(font_dir, output):
+    lines = [
+        "#pragma once",
+        "",
+        "// Generated by tools/build_assets.py. Do not edit.",
+        "",
+        "#include <asset.h>",
+        "",
+    ]
+
+    fonts = {}
+    for asset in ASSETS:
+        if asset["font"] not in fonts:
+            fonts[asset["font"]] = load_font(font_dir, asset["font"])
+        pixels = render_text(fonts[asset["font"]], asset["text"], asset["cursor"])
+        x, y, width, height, runs = encode(pixels)
+
+        name = asset["name"]
+        lines.append("const uint16_t %s_runs[] = {" % name)
+        for i in range(0, len(runs), 12):
+            lines.append("\t" + ", ".join("0x%04X" % run for run in runs[i:i + 12]) + ",")
+        lines.append("};")
+        lines.append("const Asset %s_asset = {" % name)
+        lines.append("\t%d, %d, %d, %d," % (x, y, width, height))
+        lines.append("\t{ 0x%04X, 0x%04X }," % (asset["bg"], asset["fg"]))
+        lines.append("\t%s_runs, %d" % (name, len(runs)))
+        lines.append("};")
+        lines.append("")
+
+    os.makedirs(os.path.dirname(output), exist_ok=True)
+    with open(output, "w") as f:
+        f.write("\n".join(lines))
+
+
+def find_font_dir(libdeps_dir):
+    for root, dirs, files in os.walk(libdeps_dir):
+        if os.path.basename(root) == "Fonts" and "FreeSerif18pt7b.h" in files:
+            return root
+    raise RuntimeError("Couldn't find the Adafruit GFX fonts in " + libdeps_dir)
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    output_dir = os.path.join(env.subst("$BUILD_DIR"), "assets")
+    env.Append(CPPPATH=[output_dir])
+
+    def build_assets(target, source, env):
+        libdeps_dir = os.path.join(env.subst("$PROJECT_LIBDEPS_DIR"), env.subst("$PIOENV"))
+        generate(find_font_dir(libdeps_dir), os.path.join(output_dir, "assets.h"))
+
+    main_object = os.path.join("$BUILD_DIR", "src", "main.cpp.o")
+    env.AddPreAction(main_object, build_assets)
+    env.Depends(main_object, os.path.join("$PROJECT_DIR", "tools", "build_assets.py"))
+elif __name__ == "__main__":
+    generate(sys.argv[1], sys.argv[2])
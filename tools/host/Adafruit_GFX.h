@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in: drawing is discarded.
+
+typedef struct {
+	uint16_t bitmapOffset;
+	uint8_t width, height, xAdvance;
+	int8_t xOffset, yOffset;
+} GFXglyph;
+
+typedef struct {
+	uint8_t *bitmap;
+	GFXglyph *glyph;
+	uint16_t first, last;
+	uint8_t yAdvance;
+} GFXfont;
+
+class Adafruit_GFX : public Print {
+	public:
+		void getTextBounds(const char *, int16_t, int16_t, int16_t *x, int16_t *y, uint16_t *w, uint16_t *h) { *x = *y = 0; *w = *h = 0; }
+		void setTextColor(uint16_t) {}
+		void setTextColor(uint16_t, uint16_t) {}
+		void setTextSize(uint8_t) {}
+		void setFont(const GFXfont * = NULL) {}
+		void setCursor(int16_t, int16_t) {}
+		void setRotation(uint8_t) {}
+		void fillScreen(uint16_t) {}
+		void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+		void drawLine(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+		void drawPixel(int16_t, int16_t, uint16_t) {}
+		void startWrite() {}
+		void endWrite() {}
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Adafruit_GFX.h>
+
+#define ST77XX_WHITE (0xFFFF)
+#define ST77XX_BLACK (0x0000)
+
+class Adafruit_ST7789 : public Adafruit_GFX {
+	public:
+		Adafruit_ST7789(int, int, int, int) {}
+		void init(uint16_t, uint16_t) {}
+		void setSPISpeed(uint32_t) {}
+		void setAddrWindow(uint16_t, uint16_t, uint16_t, uint16_t) {}
+		void writeColor(uint16_t, uint32_t) {}
+		void enableDisplay(bool) {}
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+/**
+ * Host stand-in for the Arduino core, so that src/main.cpp can be built and
+ * driven by the tools in this directory. Time is virtual and only moves when
+ * the tool advances it, and pin writes are recorded rather than performed.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "host.h"
+
+#define HIGH (1)
+#define LOW (0)
+#define INPUT (0)
+#define OUTPUT (1)
+#define INPUT_PULLUP (2)
+#define FALLING (2)
+#define RISING (3)
+#define CHANGE (4)
+#define XIP_BASE ((intptr_t) host_flash)
+
+inline unsigned long millis() { return host_time; }
+inline unsigned long micros() { return host_time * 1000; }
+inline void delay(unsigned long ms) { host_time += ms; }
+inline void delayMicroseconds(unsigned int) {}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int pin, int value) { host_pins[pin] = value; }
+inline int digitalRead(int pin) { return host_pins[pin]; }
+inline void analogWrite(int pin, int value) { host_pins[pin] = value; }
+inline void analogWriteFreq(uint32_t) {}
+inline void analogWriteRange(uint32_t) {}
+inline void tone(int, unsigned int, unsigned long=0) {}
+inline void noTone(int) {}
+
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class Print {
+	public:
+		size_t print(const char *) { return 0; }
+		size_t print(int) { return 0; }
+		size_t println(unsigned long) { return 0; }
+		size_t println(int) { return 0; }
+		size_t println(double, int=2) { return 0; }
+		size_t printf(const char *, ...) { return 0; }
+};
+
+class Stream : public Print {
+	public:
+		long parseInt() { return 0; }
+		float parseFloat() { return 0; }
+};
+
+/**
+ * A stream over fixed text, parsed as the Arduino core does: skip anything
+ * that can't start a number, and read 0 once the text runs out.
+ */
+class TextStream : public Stream {
+	public:
+		const char *next = "";
+
+		long parseInt() {
+			skip();
+			char *end;
+			long value = strtol(next, &end, 10);
+			next = end;
+			return value;
+		}
+		float parseFloat() {
+			skip();
+			char *end;
+			float value = strtof(next, &end);
+			next = end;
+			return value;
+		}
+
+	private:
+		void skip() {
+			while (*next != '\0' && strchr("-.0123456789", *next) == nullptr) next++;
+		}
+};
+
+class SerialType : public Stream {
+	public:
+		void begin(unsigned long=115200) {}
+};
+extern SerialType Serial;
+
+class FifoType {
+	public:
+		void push(uint32_t) {}
+		uint32_t pop() { return 0; }
+};
+
+class RP2040Type {
+	public:
+		FifoType fifo;
+		void idleOtherCore() {}
+		void resumeOtherCore() {}
+		void wdt_begin(uint32_t) {}
+		void wdt_reset() {}
+};
+extern RP2040Type rp2040;
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host stand-in: the filesystem only mounts when a tool has given it a
+// CALIBRATION file, and writes go nowhere.
+
+class File : public TextStream {
+	public:
+		bool open = false;
+
+		operator bool() const { return open; }
+		void close() { open = false; }
+};
+
+class FS {
+	public:
+		bool begin() { return host_calibration_file != nullptr; }
+		void end() {}
+		File open(const char *path, const char *mode) {
+			File f;
+			if (host_calibration_file != nullptr && strcmp(path, "CALIBRATION") == 0) {
+				f.open = true;
+				if (strcmp(mode, "r") == 0) f.next = host_calibration_file;
+			}
+			return f;
+		}
+};
+extern FS LittleFS;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <asset.h>
+
+// Host stand-in for the generated assets: a single blank pixel each.
+
+const uint16_t splash_runs[] = { 0x0001 };
+const Asset splash_asset = { 0, 0, 1, 1, { 0x0000, 0xFFFF }, splash_runs, 1 };
@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * Pulls the firmware into the including tool, so that the tool can drive the
+ * real control code against a simulated or recorded oven. The firmware keeps
+ * its state in globals, so each process can only drive one oven at a time;
+ * tools that want parallelism fork.
+ */
+
+#include "../../src/main.cpp"
+#include <thermal_model.h>
+
+/**
+ * Boots the firmware with the given calibration, as if it had been read back
+ * from flash, with the oven sitting at start_temp.
+ */
+inline void firmware_boot(const ThermalModel& model, int lag_degrees, float start_temp) {
+	host_time = 0;
+	host_temperature = start_temp;
+	setup();
+
+	calibration_cool_lag_time = model.cool_lag_time;
+	calibration_heat_lag_time = model.heat_lag_time;
+	calibration_lag_degrees = lag_degrees;
+	is_calibrated = true;
+}
+
+/**
+ * Runs the firmware's loop() against a simulated oven until it leaves the
+ * given state or time_limit passes. on_tick is called with the simulation
+ * after every loop. Returns false if the time limit was hit.
+ */
+template <class Callback>
+bool firmware_run(ThermalSimulation& sim, State state, unsigned long time_limit, Callback on_tick) {
+	next_state = state;
+	unsigned long start_time = host_time;
+	bool entered = false;
+	while (host_time - start_time < time_limit) {
+		unsigned long before = host_time;
+		loop();
+		sim.step(host_time - before, host_pins[TOP_ELEMENT] || host_pins[BOTTOM_ELEMENT]);
+		host_temperature = sim.temp;
+		on_tick(sim);
+
+		if (current_state == state) entered = true;
+		else if (entered) return true;
+	}
+	return false;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "../host.h"
+
+#define FLASH_PAGE_SIZE (256)
+#define FLASH_SECTOR_SIZE (4096)
+
+// Only the settings sector exists, and XIP_BASE points at it, so offsets
+// count from there.
+inline void flash_range_erase(uint32_t offset, size_t count) {
+	memset(host_flash + offset, 0xFF, count);
+	host_flash_erases++;
+}
+inline void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+	memcpy(host_flash + offset, data, count);
+}
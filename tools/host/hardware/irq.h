@@ -0,0 +1,6 @@
+#pragma once
+
+#define TIMER_IRQ_0 (0)
+#define PICO_HIGHEST_IRQ_PRIORITY (0)
+
+inline void irq_set_priority(unsigned, unsigned) {}
@@ -0,0 +1,24 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+
+unsigned long host_time = 0;
+double host_temperature = NAN;
+int host_pins[32] = {0};
+
+SerialType Serial;
+FS LittleFS;
+RP2040Type rp2040;
+
+// The settings sector, blank as if freshly erased.
+extern "C" {
+	uint8_t _EEPROM_start[4096] __attribute__((aligned(4)));
+}
+
+uint8_t *const host_flash = _EEPROM_start;
+int host_flash_erases = 0;
+const char *host_calibration_file = nullptr;
+
+static bool host_init_flash = [] {
+	memset(_EEPROM_start, 0xFF, sizeof(_EEPROM_start));
+	return true;
+}();
@@ -0,0 +1,20 @@
+#pragma once
+
+/**
+ * Controls for the host stand-ins. Tools set the virtual clock and the
+ * temperature the thermocouple will report, and read back the pins the
+ * firmware has written and the settings it has saved.
+ */
+
+#include <stdint.h>
+
+extern unsigned long host_time;
+extern double host_temperature;
+extern int host_pins[32];
+
+// The flash settings sector, and how many times it has been erased.
+extern uint8_t *const host_flash;
+extern int host_flash_erases;
+// Contents of the CALIBRATION file, or null for a filesystem that won't
+// mount.
+extern const char *host_calibration_file;
@@ -0,0 +1,74 @@
+#pragma once
+
+/**
+ * Runs a tool's work across several processes. The firmware keeps its state
+ * in globals, so anything that drives it needs a process of its own, and
+ * results come back through shared memory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <type_traits>
+
+/**
+ * Calls work(i) for every i below count, over up to jobs processes, and
+ * stores what it returns in results[i]. Normally each process works through
+ * every jobs'th item. With fresh set, every item gets a process of its own,
+ * so nothing one item leaves in the firmware's globals reaches the next.
+ *
+ * Items whose process couldn't be started or died keep the value they had
+ * in results. Returns false if that happened to any.
+ */
+template <class Result, class Work>
+bool run_jobs(int jobs, size_t count, Result *results, Work work, bool fresh = false) {
+	static_assert(std::is_trivially_copyable<Result>::value, "Results are copied between processes");
+	if (jobs < 1) jobs = 1;
+	if (count == 0) return true;
+
+	Result *shared = (Result *) mmap(nullptr, count * sizeof(Result),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	memcpy((void *) shared, (const void *) results, count * sizeof(Result));
+
+	// Each task is a first item and a stride through the rest.
+	size_t tasks = fresh ? count : (size_t) jobs < count ? jobs : count;
+	size_t stride = fresh ? count : tasks;
+	size_t next = 0;
+	int running = 0;
+	bool all_ok = true;
+	while (next < tasks || running > 0) {
+		if (next < tasks && running < jobs) {
+			pid_t pid = fork();
+			if (pid == 0) {
+				for (size_t i = next; i < count; i += stride) {
+					shared[i] = work(i);
+				}
+				_exit(0);
+			}
+			if (pid < 0) {
+				perror("fork");
+				all_ok = false;
+			} else {
+				running++;
+			}
+			next++;
+			continue;
+		}
+
+		int status;
+		if (wait(&status) < 0) break;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) all_ok = false;
+	}
+
+	memcpy((void *) results, (const void *) shared, count * sizeof(Result));
+	munmap(shared, count * sizeof(Result));
+	return all_ok;
+}
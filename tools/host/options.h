@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+ * Command line options for the host tools. Each tool registers its options
+ * against its own variables, then hands over argv. Options take the form
+ * --name=value, or just --name for flags, and anything else is a path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+class OptionParser {
+	public:
+		enum Type {
+			FLOAT,
+			INT,
+			STRING,
+			FLAG
+		};
+		class Option {
+			public:
+				const char *name;
+				Type type;
+				void *value;
+		};
+		std::vector<Option> options;
+
+		void add(const char *name, float *value) { options.push_back(Option{ name, FLOAT, value }); }
+		void add(const char *name, int *value) { options.push_back(Option{ name, INT, value }); }
+		void add(const char *name, const char **value) { options.push_back(Option{ name, STRING, value }); }
+		void add_flag(const char *name, bool *value) { options.push_back(Option{ name, FLAG, value }); }
+
+		/**
+		 * Parses argv into the registered options. Paths are collected into
+		 * paths, or rejected if it is null. Prints the problem and returns
+		 * false on anything it doesn't understand.
+		 */
+		bool parse(int argc, char **argv, std::vector<const char *> *paths = nullptr) {
+			for (int i = 1; i < argc; i++) {
+				const char *arg = argv[i];
+				if (strncmp(arg, "--", 2) != 0) {
+					if (paths == nullptr) {
+						fprintf(stderr, "Bad argument: %s\n", arg);
+						return false;
+					}
+					paths->push_back(arg);
+					continue;
+				}
+
+				const char *equals = strchr(arg, '=');
+				std::string name = equals ? std::string(arg + 2, equals - arg - 2) : std::string(arg + 2);
+				Option *option = find(name);
+				if (option == nullptr) {
+					fprintf(stderr, "Unknown option: --%s\n", name.c_str());
+					return false;
+				}
+				if ((option->type == FLAG) != (equals == nullptr)) {
+					fprintf(stderr, option->type == FLAG ? "--%s takes no value\n" : "--%s needs a value\n", name.c_str());
+					return false;
+				}
+				if (option->type != FLAG && !set(*option, equals + 1)) {
+					fprintf(stderr, "Bad value for --%s: %s\n", name.c_str(), equals + 1);
+					return false;
+				}
+				if (option->type == FLAG) {
+					*(bool *) option->value = true;
+				}
+			}
+			return true;
+		}
+
+		Option *find(const std::string& name) {
+			for (auto& option : options) {
+				if (name == option.name) return &option;
+			}
+			return nullptr;
+		}
+
+		bool set(const Option& option, const char *text) {
+			char *end;
+			switch (option.type) {
+				case FLOAT:
+					*(float *) option.value = strtof(text, &end);
+					return end != text && *end == '\0';
+				case INT:
+					*(int *) option.value = (int) strtol(text, &end, 10);
+					return end != text && *end == '\0';
+				case STRING:
+					*(const char **) option.value = text;
+					return true;
+				default:
+					return false;
+			}
+		}
+};
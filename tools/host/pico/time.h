@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in: timers never fire.
+
+typedef struct repeating_timer {
+	int64_t delay_us;
+} repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *);
+
+inline bool add_repeating_timer_ms(int32_t, repeating_timer_callback_t, void *, repeating_timer_t *) { return true; }
+inline bool add_repeating_timer_us(int64_t, repeating_timer_callback_t, void *, repeating_timer_t *) { return true; }
+inline bool cancel_repeating_timer(repeating_timer_t *) { return true; }
+
+typedef struct alarm_pool {
+	unsigned hardware_alarm;
+} alarm_pool_t;
+
+inline alarm_pool_t *alarm_pool_create(unsigned, unsigned) { return nullptr; }
+inline bool alarm_pool_add_repeating_timer_ms(alarm_pool_t *, int32_t, repeating_timer_callback_t, void *, repeating_timer_t *) { return true; }
+
+typedef uint64_t absolute_time_t;
+
+inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return ms; }
+inline bool best_effort_wfe_or_timeout(absolute_time_t) { return true; }
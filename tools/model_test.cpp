@@ -0,0 +1,439 @@
+/**
+ * Checks for the thermal model's estimator and the settings it is saved in,
+ * the safety supervisor and the button sampling, built against the host
+ * stand-ins. Exits non-zero if any check fails.
+ *
+ * Usage: model_test
+ */
+
+#include "host/firmware.h"
+
+#include <math.h>
+
+#include <vector>
+
+int checks = 0;
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+void check(bool ok, const char *text, int line) {
+	checks++;
+	if (!ok) {
+		failures++;
+		printf("FAILED line %d: %s\n", line, text);
+	}
+}
+
+bool is_near(float value, float expected, float fraction) {
+	return fabsf(value - expected) <= fabsf(expected) * fraction;
+}
+
+/**
+ * Cycles a simulated oven between 150C and 220C, as a bake's soak and reflow
+ * would, and feeds the readings to the estimator at the sensor's resolution.
+ */
+void run_oven(ThermalEstimator& estimator, const ThermalModel& oven, unsigned long duration) {
+	ThermalSimulation sim(oven, oven.ambient);
+	bool elements_on = true;
+	for (unsigned long t = 0; t < duration; t += 250) {
+		if (sim.temp > 220) elements_on = false;
+		if (sim.temp < 150) elements_on = true;
+		estimator.add_sample(sim.time, roundf(sim.temp * 4) / 4, elements_on);
+		sim.step(250, elements_on);
+	}
+}
+
+void test_converges() {
+	ThermalModel reference;
+	ThermalModel oven = reference;
+	oven.heat_rate = reference.heat_rate * 1.2f;
+	oven.loss_rate = reference.loss_rate * 1.2f;
+
+	ThermalEstimator estimator;
+	estimator.begin(reference, reference);
+	run_oven(estimator, oven, 1'800'000);
+
+	CHECK(estimator.is_converged());
+	CHECK(is_near(estimator.model.heat_rate, oven.heat_rate, 0.05));
+	CHECK(is_near(estimator.model.loss_rate, oven.loss_rate, 0.05));
+}
+
+void test_stays_in_bounds() {
+	ThermalModel reference;
+	ThermalEstimator estimator;
+	estimator.min_scale = 0.5;
+	estimator.max_scale = 2;
+
+	// Left alone, these ovens would pull the estimate well past the bounds,
+	// so it should end up held at them.
+	ThermalModel strong = reference;
+	strong.heat_rate = reference.heat_rate * 5;
+	estimator.begin(reference, reference);
+	run_oven(estimator, strong, 1'800'000);
+	CHECK(estimator.model.heat_rate <= reference.heat_rate * 2);
+	CHECK(is_near(estimator.model.heat_rate, reference.heat_rate * 2, 0.01));
+	CHECK(estimator.model.loss_rate >= reference.loss_rate * 0.5f);
+	CHECK(estimator.model.loss_rate <= reference.loss_rate * 2);
+
+	ThermalModel weak = reference;
+	weak.heat_rate = reference.heat_rate / 2.5f;
+	weak.loss_rate = reference.loss_rate / 5;
+	estimator.begin(reference, reference);
+	run_oven(estimator, weak, 1'800'000);
+	CHECK(estimator.model.heat_rate >= reference.heat_rate * 0.5f);
+	CHECK(estimator.model.loss_rate >= reference.loss_rate * 0.5f);
+	CHECK(is_near(estimator.model.heat_rate, reference.heat_rate * 0.5f, 0.01));
+	CHECK(is_near(estimator.model.loss_rate, reference.loss_rate * 0.5f, 0.01));
+}
+
+void reset_settings() {
+	memset(host_flash, 0xFF, FLASH_SECTOR_SIZE);
+	host_calibration_file = nullptr;
+	is_calibrated = false;
+	calibration_cool_lag_time = 0;
+	calibration_heat_lag_time = 0;
+	calibration_lag_degrees = 0;
+	model_adapted = true;
+	model_heat_rate = 0;
+	model_loss_rate = 0;
+}
+
+void test_old_settings_not_adapted() {
+	// Version 1 records stopped after lag_degrees.
+	class RecordV1 {
+		public:
+			uint32_t magic;
+			uint32_t version;
+			uint32_t cool_lag_time;
+			uint32_t heat_lag_time;
+			int32_t lag_degrees;
+			uint32_t crc;
+	};
+	reset_settings();
+	RecordV1 old{ SETTINGS_MAGIC, 1, 20'000, 10'000, 8, 0 };
+	old.crc = crc32(&old, offsetof(RecordV1, crc));
+	memcpy(host_flash, &old, sizeof(old));
+	CHECK(!read_flash_settings());
+
+	// An old CALIBRATION file alongside it is used instead.
+	host_calibration_file = "20000\r\n10000\r\n8\r\n";
+	load_settings();
+	CHECK(is_calibrated);
+	CHECK(calibration_cool_lag_time == 20'000);
+	CHECK(calibration_heat_lag_time == 10'000);
+	CHECK(calibration_lag_degrees == 8);
+	CHECK(!model_adapted);
+
+	reset_settings();
+	host_calibration_file = "20000\r\n10000\r\n8\r\n1.650000\r\n0.007500\r\n";
+	load_settings();
+	CHECK(model_adapted);
+	CHECK(is_near(model_heat_rate, 1.65, 0.001));
+	CHECK(is_near(model_loss_rate, 0.0075, 0.001));
+}
+
+void test_settings_round_trip() {
+	reset_settings();
+	calibration_cool_lag_time = 21'000;
+	calibration_heat_lag_time = 11'000;
+	calibration_lag_degrees = 9;
+	model_adapted = true;
+	model_heat_rate = 1.7;
+	model_loss_rate = 0.008;
+	write_flash_settings();
+
+	calibration_cool_lag_time = calibration_heat_lag_time = 0;
+	calibration_lag_degrees = 0;
+	model_adapted = false;
+	model_heat_rate = model_loss_rate = 0;
+	CHECK(read_flash_settings());
+	CHECK(calibration_cool_lag_time == 21'000);
+	CHECK(calibration_heat_lag_time == 11'000);
+	CHECK(calibration_lag_degrees == 9);
+	CHECK(model_adapted);
+	CHECK(model_heat_rate == 1.7f);
+	CHECK(model_loss_rate == 0.008f);
+}
+
+void test_saves_only_changes() {
+	reset_settings();
+	is_calibrated = true;
+	calibration_cool_lag_time = 20'000;
+	calibration_heat_lag_time = 10'000;
+	calibration_lag_degrees = 8;
+	ThermalModel model = get_calibrated_model();
+	model_adapted = true;
+	model_heat_rate = model.heat_rate;
+	model_loss_rate = model.loss_rate;
+
+	// An oven that still matches what was stored isn't saved again.
+	estimator.begin(model, model);
+	run_oven(estimator, model, 1'800'000);
+	int erases = host_flash_erases;
+	bake_run_finished();
+	CHECK(host_flash_erases == erases);
+
+	ThermalModel changed = model;
+	changed.heat_rate *= 1.15f;
+	estimator.begin(model, model);
+	run_oven(estimator, changed, 1'800'000);
+	bake_run_finished();
+	CHECK(host_flash_erases == erases + 1);
+	CHECK(is_near(model_heat_rate, changed.heat_rate, 0.05));
+
+	// Nor is one that hasn't seen enough to be trusted.
+	model_adapted = false;
+	estimator.begin(model, model);
+	run_oven(estimator, changed, 30'000);
+	bake_run_finished();
+	CHECK(host_flash_erases == erases + 1);
+	CHECK(!model_adapted);
+}
+
+/**
+ * Boots to the main menu with a fresh reading and the latch cleared.
+ */
+void reset_safety() {
+	firmware_boot(ThermalModel(), 15, 25);
+	safety_fault = SAFETY_OK;
+	rise_was_heating = false;
+	next_state = MAIN_MENU;
+	update_temperature();
+}
+
+/**
+ * Advances the clock, taking a reading at temp every tick and supervising
+ * every supervisor period in between.
+ */
+void run_supervised(unsigned long duration, float temp) {
+	for (unsigned long t = 0; t < duration; t += SUPERVISOR_PERIOD_MS) {
+		host_time += SUPERVISOR_PERIOD_MS;
+		if (t % TICK_MS == 0) {
+			host_temperature = temp;
+			update_temperature();
+		}
+		supervise(nullptr);
+	}
+}
+
+void test_over_temperature_trips() {
+	reset_safety();
+	set_elements_state(true);
+	run_supervised(1'000, SAFETY_MAX_TEMP - 10);
+	CHECK(safety_fault == SAFETY_OK);
+
+	run_supervised(TICK_MS, SAFETY_MAX_TEMP + 5);
+	CHECK(safety_fault == SAFETY_OVER_TEMP);
+	CHECK(!test_elements_state);
+	CHECK(host_pins[TOP_ELEMENT] == LOW && host_pins[BOTTOM_ELEMENT] == LOW);
+
+	// Even with the elements already off.
+	reset_safety();
+	run_supervised(TICK_MS, SAFETY_MAX_TEMP + 5);
+	CHECK(safety_fault == SAFETY_OVER_TEMP);
+}
+
+void test_stale_readings_trip() {
+	reset_safety();
+	set_elements_state(true);
+	for (unsigned long t = 0; t <= SAFETY_STALE_MS; t += SUPERVISOR_PERIOD_MS) {
+		host_time += SUPERVISOR_PERIOD_MS;
+		supervise(nullptr);
+	}
+	CHECK(safety_fault == SAFETY_STALE);
+	CHECK(host_pins[TOP_ELEMENT] == LOW && host_pins[BOTTOM_ELEMENT] == LOW);
+
+	// Faulted readings are no better than none, whilst a state needs them.
+	reset_safety();
+	readings_required = true;
+	run_supervised(SAFETY_STALE_MS / 2, NAN);
+	CHECK(safety_fault == SAFETY_OK);
+	run_supervised(SAFETY_STALE_MS, NAN);
+	CHECK(safety_fault == SAFETY_STALE);
+	readings_required = false;
+}
+
+void test_no_rise_trips() {
+	reset_safety();
+	set_elements_state(true);
+	float temp = 25;
+	for (unsigned long t = 0; t < 2 * SAFETY_RISE_WINDOW_MS; t += TICK_MS) {
+		temp += SAFETY_MIN_RISE * 2.0f * TICK_MS / SAFETY_RISE_WINDOW_MS;
+		run_supervised(TICK_MS, temp);
+	}
+	CHECK(safety_fault == SAFETY_OK);
+
+	run_supervised(SAFETY_RISE_WINDOW_MS + TICK_MS, temp);
+	CHECK(safety_fault == SAFETY_NO_RISE);
+	CHECK(host_pins[TOP_ELEMENT] == LOW && host_pins[BOTTOM_ELEMENT] == LOW);
+}
+
+void test_latch_holds_elements_off() {
+	reset_safety();
+	safety_trip(SAFETY_SENSOR_FAULT, micros());
+	set_elements_state(true);
+	CHECK(!test_elements_state);
+	CHECK(host_pins[TOP_ELEMENT] == LOW && host_pins[BOTTOM_ELEMENT] == LOW);
+
+	// Nor can anything but acknowledging it clear the fault, or send the
+	// firmware anywhere else first.
+	safety_trip(SAFETY_OVER_TEMP, micros());
+	CHECK(safety_fault == SAFETY_SENSOR_FAULT);
+	push_input_event(TOP_LEFT, PRESS);
+	loop();
+	CHECK(current_state == FAULT);
+}
+
+/**
+ * Releases every button and empties the input queue.
+ */
+void reset_buttons() {
+	for (int i = 0; i < NUM_BUTTONS; i++) {
+		host_pins[buttons[i].pin] = HIGH;
+		buttons[i].history = 0;
+		buttons[i].pressed = false;
+	}
+	input_head = input_tail = 0;
+}
+
+/**
+ * Runs the button timer for duration with button held down or not.
+ */
+void sample_for(Button button, bool down, unsigned long duration) {
+	for (unsigned long t = 0; t < duration; t += BUTTON_SAMPLE_MS) {
+		host_pins[buttons[button].pin] = down ? LOW : HIGH;
+		host_time += BUTTON_SAMPLE_MS;
+		sample_buttons(nullptr);
+	}
+}
+
+class InputEvent {
+	public:
+		int button;
+		int type;
+		unsigned long time;
+};
+
+/**
+ * Takes everything out of the input queue, stamped with the current time.
+ */
+std::vector<InputEvent> take_events() {
+	std::vector<InputEvent> events;
+	while (input_tail != input_head) {
+		uint8_t event = input_events[input_tail];
+		input_tail = (input_tail + 1) % INPUT_QUEUE_SIZE;
+		events.push_back(InputEvent{ event >> 2, event & 0x3, host_time });
+	}
+	return events;
+}
+
+void test_bounce_is_ignored() {
+	reset_buttons();
+	// Contact bounce: never down for as long as the debounce needs.
+	for (int i = 0; i < 10; i++) {
+		sample_for(TOP_RIGHT, true, BUTTON_SAMPLE_MS * 3);
+		sample_for(TOP_RIGHT, false, BUTTON_SAMPLE_MS);
+	}
+	sample_for(TOP_RIGHT, false, BUTTON_SAMPLE_MS * 8);
+	CHECK(take_events().empty());
+
+	// Bounce on the way down still gives a single press once it settles.
+	sample_for(TOP_RIGHT, true, BUTTON_SAMPLE_MS * 2);
+	sample_for(TOP_RIGHT, false, BUTTON_SAMPLE_MS);
+	sample_for(TOP_RIGHT, true, BUTTON_SAMPLE_MS * 20);
+	std::vector<InputEvent> events = take_events();
+	CHECK(events.size() == 1);
+	CHECK(events.size() == 1 && events[0].button == TOP_RIGHT && events[0].type == PRESS);
+
+	// And so does bounce on the way up.
+	sample_for(TOP_RIGHT, false, BUTTON_SAMPLE_MS * 2);
+	sample_for(TOP_RIGHT, true, BUTTON_SAMPLE_MS);
+	sample_for(TOP_RIGHT, false, BUTTON_SAMPLE_MS * 20);
+	CHECK(take_events().empty());
+}
+
+void test_hold_repeats() {
+	reset_buttons();
+	std::vector<InputEvent> events;
+	unsigned long pressed_time = 0;
+	for (unsigned long t = 0; t < 3'000; t += BUTTON_SAMPLE_MS) {
+		sample_for(BOTTOM_RIGHT, true, BUTTON_SAMPLE_MS);
+		for (const InputEvent& event : take_events()) {
+			if (event.type == PRESS) pressed_time = event.time;
+			events.push_back(event);
+		}
+	}
+
+	int presses = 0;
+	int long_presses = 0;
+	std::vector<unsigned long> repeats;
+	for (const InputEvent& event : events) {
+		CHECK(event.button == BOTTOM_RIGHT);
+		if (event.type == PRESS) presses++;
+		if (event.type == LONG_PRESS) {
+			long_presses++;
+			CHECK(event.time - pressed_time == BUTTON_LONG_PRESS_MS);
+		}
+		if (event.type == REPEAT) repeats.push_back(event.time - pressed_time);
+	}
+	CHECK(presses == 1);
+	CHECK(long_presses == 1);
+
+	// The first repeat comes after the delay, then at the starting period,
+	// speeding up to the fastest.
+	CHECK(repeats.size() > 3);
+	if (repeats.size() > 3) {
+		CHECK(repeats[0] == BUTTON_REPEAT_DELAY_MS);
+		CHECK(repeats[1] - repeats[0] == BUTTON_REPEAT_START_MS);
+		unsigned long last_gap = BUTTON_REPEAT_START_MS;
+		for (size_t i = 2; i < repeats.size(); i++) {
+			unsigned long gap = repeats[i] - repeats[i - 1];
+			CHECK(gap <= last_gap && gap >= BUTTON_REPEAT_MIN_MS);
+			last_gap = gap;
+		}
+		CHECK(last_gap == BUTTON_REPEAT_MIN_MS);
+	}
+
+	// Letting go stops it.
+	sample_for(BOTTOM_RIGHT, false, 1'000);
+	CHECK(take_events().empty());
+}
+
+void test_full_queue_drops() {
+	reset_buttons();
+	for (int i = 0; i < INPUT_QUEUE_SIZE + 4; i++) {
+		push_input_event((Button) (i % NUM_BUTTONS), PRESS);
+	}
+	std::vector<InputEvent> events = take_events();
+	// One slot is always kept free to tell full from empty.
+	CHECK(events.size() == INPUT_QUEUE_SIZE - 1);
+	bool in_order = true;
+	for (size_t i = 0; i < events.size(); i++) {
+		if (events[i].button != (int) (i % NUM_BUTTONS)) in_order = false;
+	}
+	CHECK(in_order);
+
+	// With room again, events go in as normal.
+	push_input_event(TOP_LEFT, LONG_PRESS);
+	events = take_events();
+	CHECK(events.size() == 1 && events[0].type == LONG_PRESS);
+}
+
+int main() {
+	test_converges();
+	test_stays_in_bounds();
+	test_old_settings_not_adapted();
+	test_settings_round_trip();
+	test_saves_only_changes();
+	test_over_temperature_trips();
+	test_stale_readings_trip();
+	test_no_rise_trips();
+	test_latch_holds_elements_off();
+	test_bounce_is_ignored();
+	test_hold_repeats();
+	test_full_queue_drops();
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * Checks how robust the bake controller is across a fleet of ovens that
+ * differ from the one it was tuned on.
+ *
+ * Each simulated oven draws its element power, insulation and dead times
+ * from a spread around the nominal model. Its thermocouple lags the chamber
+ * depending on where it sits, and adds noise and the MAX31855's 0.25C
+ * quantisation. Every controller configuration bakes the same set of ovens
+ * through the real firmware. The tool then reports percentiles of overshoot,
+ * tracking error and cycle time, along with the failure rate.
+ *
+ * Usage: monte_carlo [--option=value ...]
+ */
+
+#include "host/firmware.h"
+#include "host/jobs.h"
+#include "host/options.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+class Options {
+	public:
+		int runs = 1000;
+		int seed = 1;
+		int jobs = 8;
+
+		// Spread of the plant, as a fraction of the nominal value (one
+		// standard deviation) or as a range for dead times.
+		float heat_rate_spread = 0.15;
+		float loss_rate_spread = 0.2;
+		float heat_lag_min = 6'000;
+		float heat_lag_max = 14'000;
+		float cool_lag_min = 14'000;
+		float cool_lag_max = 26'000;
+		float ambient_min = 15;
+		float ambient_max = 35;
+
+		// Sensor.
+		float probe_lag_max = 10'000;
+		float noise = 0.5;
+		float quantisation = 0.25;
+
+		// Paste limits, for deciding whether a bake failed.
+		float liquidus = 217;
+		float tal_min = 30;
+		float peak_max = 260;
+};
+
+/**
+ * One physical oven, and the sensor fitted to it.
+ */
+class Oven {
+	public:
+		ThermalModel model;
+		unsigned long probe_lag;
+		int lag_degrees;
+};
+
+class Configuration {
+	public:
+		const char *name;
+		// Calibrate the firmware against each oven, rather than leaving the
+		// fleet's nominal calibration in place.
+		bool calibrated;
+};
+
+const Configuration configurations[] = {
+	{ "nominal calibration", false },
+	{ "per-oven calibration", true },
+};
+#define NUM_CONFIGURATIONS (sizeof(configurations) / sizeof(configurations[0]))
+
+class Outcome {
+	public:
+		// Ran to the end without the supervisor stepping in.
+		bool completed;
+		// Completed, but outside the paste's limits.
+		bool failed;
+		float overshoot;
+		float rms_error;
+		float cycle_time;
+};
+
+bool parse_options(int argc, char **argv, Options& options) {
+	OptionParser parser;
+	parser.add("runs", &options.runs);
+	parser.add("seed", &options.seed);
+	parser.add("jobs", &options.jobs);
+	parser.add("heat-rate-spread", &options.heat_rate_spread);
+	parser.add("loss-rate-spread", &options.loss_rate_spread);
+	parser.add("heat-lag-min", &options.heat_lag_min);
+	parser.add("heat-lag-max", &options.heat_lag_max);
+	parser.add("cool-lag-min", &options.cool_lag_min);
+	parser.add("cool-lag-max", &options.cool_lag_max);
+	parser.add("ambient-min", &options.ambient_min);
+	parser.add("ambient-max", &options.ambient_max);
+	parser.add("probe-lag-max", &options.probe_lag_max);
+	parser.add("noise", &options.noise);
+	parser.add("quantisation", &options.quantisation);
+	parser.add("liquidus", &options.liquidus);
+	parser.add("tal-min", &options.tal_min);
+	parser.add("peak-max", &options.peak_max);
+	return parser.parse(argc, argv);
+}
+
+/**
+ * The oven the controller was tuned on, as its calibration describes it.
+ */
+ThermalModel get_nominal_model() {
+	return ThermalModel::from_calibration(20'000, 10'000, 15);
+}
+
+/**
+ * Draws the index'th oven. Each oven depends only on the seed and its index,
+ * so every configuration and every job sees the same fleet.
+ */
+Oven sample_oven(const Options& options, int index) {
+	std::mt19937 rng((unsigned) options.seed * 1'000'003u + index);
+	std::normal_distribution<float> unit(0, 1);
+	auto uniform = [&](float low, float high) {
+		return std::uniform_real_distribution<float>(low, high)(rng);
+	};
+
+	ThermalModel nominal = get_nominal_model();
+	Oven oven;
+	oven.model.heat_rate = nominal.heat_rate * std::max(0.3f, 1 + options.heat_rate_spread * unit(rng));
+	oven.model.loss_rate = nominal.loss_rate * std::max(0.3f, 1 + options.loss_rate_spread * unit(rng));
+	oven.model.ambient = uniform(options.ambient_min, options.ambient_max);
+	oven.model.heat_lag_time = uniform(options.heat_lag_min, options.heat_lag_max);
+	oven.model.cool_lag_time = uniform(options.cool_lag_min, options.cool_lag_max);
+	oven.probe_lag = uniform(0, options.probe_lag_max);
+
+	// What CALIBRATE_1..3 would have measured: how far the oven climbs after
+	// the elements go off at 240C. This is from_calibration() in reverse.
+	float rate_at_240 = oven.model.get_rate(240, true);
+	oven.lag_degrees = (int) (rate_at_240 * oven.model.cool_lag_time / 1000 + 0.5);
+	return oven;
+}
+
+/**
+ * Models the thermocouple: a first order lag behind the chamber, depending on
+ * where it is mounted, then noise and quantisation.
+ */
+class Probe {
+	public:
+		float value;
+		unsigned long lag;
+		float noise;
+		float quantisation;
+		std::mt19937 rng;
+
+		Probe(const Oven& oven, const Options& options, int index)
+			: value(oven.model.ambient), lag(oven.probe_lag),
+			noise(options.noise), quantisation(options.quantisation) {
+			// Like the oven, the noise depends only on the seed and the index,
+			// but is drawn separately from it.
+			std::seed_seq seed{ (unsigned) options.seed, (unsigned) index };
+			rng.seed(seed);
+		}
+
+		double read(float chamber, unsigned long dt) {
+			value += (chamber - value) * (lag == 0 ? 1 : (float) dt / (lag + dt));
+			float reading = value + std::normal_distribution<float>(0, noise)(rng);
+			if (quantisation > 0) reading = roundf(reading / quantisation) * quantisation;
+			return reading;
+		}
+};
+
+Outcome bake(const Options& options, const Configuration& config, const Oven& oven, int index) {
+	ThermalModel nominal = get_nominal_model();
+	if (config.calibrated) {
+		calibration_cool_lag_time = oven.model.cool_lag_time;
+		calibration_heat_lag_time = oven.model.heat_lag_time;
+		calibration_lag_degrees = oven.lag_degrees;
+	} else {
+		calibration_cool_lag_time = nominal.cool_lag_time;
+		calibration_heat_lag_time = nominal.heat_lag_time;
+		calibration_lag_degrees = 15;
+	}
+	// Each oven is baked once, so has nothing to learn from.
+	model_adapted = false;
+
+	// Start each bake from a freshly booted controller.
+	change_state(MAIN_MENU);
+	clear_safety_fault();
+	ThermalSimulation sim(oven.model, oven.model.ambient);
+	Probe probe(oven, options, index);
+	host_time = 0;
+	host_temperature = probe.read(sim.temp, 0);
+	air_board_estimate = NAN;
+	last_fusion_time = 0;
+	update_temperature();
+	last_tick_time = 0;
+	batch_runs = 1;
+	batch_runs_done = 0;
+
+	float peak = sim.temp;
+	double error_squared = 0;
+	unsigned long tracked_time = 0;
+	unsigned long time_above_liquidus = 0;
+	unsigned long last_time = 0;
+	unsigned long last_supervised = 0;
+
+	bool finished = firmware_run(sim, BAKE, 20 * 60'000, [&](const ThermalSimulation& s) {
+		unsigned long dt = s.time - last_time;
+		last_time = s.time;
+		host_temperature = probe.read(s.temp, dt);
+		if (s.time - last_supervised >= SUPERVISOR_PERIOD_MS) {
+			last_supervised = s.time;
+			supervise(nullptr);
+		}
+		if (dt == 0 || current_state != BAKE) return;
+
+		if (s.temp > peak) peak = s.temp;
+		if (s.temp >= options.liquidus) time_above_liquidus += dt;
+		if (reflow_state == SOAK || reflow_state == REFLOW) {
+			float desired = get_desired_temperature(reflow_state, s.time - reflow_state_start_time);
+			error_squared += (double) (s.temp - desired) * (s.temp - desired) * dt;
+			tracked_time += dt;
+		}
+	});
+
+	Outcome outcome;
+	outcome.completed = finished && safety_fault == SAFETY_OK;
+	outcome.failed = !outcome.completed
+		|| time_above_liquidus < options.tal_min * 1000
+		|| peak > options.peak_max;
+	outcome.overshoot = peak - reflow_temp;
+	outcome.rms_error = tracked_time > 0 ? sqrt(error_squared / tracked_time) : 0;
+	outcome.cycle_time = last_time / 1000.0f;
+	return outcome;
+}
+
+float get_percentile(std::vector<float>& values, float percentile) {
+	if (values.empty()) return NAN;
+	size_t index = (size_t) (percentile / 100 * (values.size() - 1) + 0.5);
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		return 1;
+	}
+	int runs = options.runs < 1 ? 1 : options.runs;
+
+	ThermalModel nominal = get_nominal_model();
+	firmware_boot(nominal, 15, nominal.ambient);
+
+	fprintf(stderr, "Baking %d ovens with %zu configurations over %d jobs...\n",
+			runs, NUM_CONFIGURATIONS, options.jobs);
+	std::vector<Outcome> outcomes(NUM_CONFIGURATIONS * runs);
+	bool all_ok = run_jobs(options.jobs, outcomes.size(), outcomes.data(), [&](size_t k) {
+		int i = k % runs;
+		return bake(options, configurations[k / runs], sample_oven(options, i), i);
+	});
+	if (!all_ok) {
+		fprintf(stderr, "A job failed.\n");
+		return 1;
+	}
+
+	printf("%-36s %7s  %-20s %-20s %-20s\n", "", "failed", "overshoot C", "rms error C", "cycle time s");
+	printf("%-36s %7s  %-20s %-20s %-20s\n", "", "", "p50 / p90 / p99", "p50 / p90 / p99", "p50 / p90 / p99");
+	for (size_t c = 0; c < NUM_CONFIGURATIONS; c++) {
+		std::vector<float> overshoot, rms_error, cycle_time;
+		int failures = 0;
+		for (int i = 0; i < runs; i++) {
+			const Outcome& o = outcomes[c * runs + i];
+			if (o.failed) failures++;
+			// Even bakes that missed the paste's limits say something about
+			// how the controller tracks, so only leave out ones cut short.
+			if (!o.completed) continue;
+			overshoot.push_back(o.overshoot);
+			rms_error.push_back(o.rms_error);
+			cycle_time.push_back(o.cycle_time);
+		}
+
+		char columns[3][32];
+		std::vector<float> *metrics[] = { &overshoot, &rms_error, &cycle_time };
+		for (int m = 0; m < 3; m++) {
+			snprintf(columns[m], sizeof(columns[m]), "%.1f / %.1f / %.1f",
+					get_percentile(*metrics[m], 50),
+					get_percentile(*metrics[m], 90),
+					get_percentile(*metrics[m], 99));
+		}
+		printf("%-36s %6.1f%%  %-20s %-20s %-20s\n",
+				configurations[c].name,
+				100.0f * failures / runs,
+				columns[0], columns[1], columns[2]);
+	}
+	return 0;
+}
@@ -0,0 +1,242 @@
+/**
+ * Searches for the shortest reflow profile that the firmware can actually
+ * follow on a calibrated oven, whilst keeping within the paste's limits.
+ *
+ * Every candidate profile is baked by the real firmware control code against
+ * a ThermalModel built from the oven's calibration. The fastest feasible one
+ * is written out as a PROFILE file for LittleFS.
+ *
+ * Usage: profile_optimiser [--option=value ...]
+ */
+
+#include "host/firmware.h"
+#include "host/jobs.h"
+#include "host/options.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+class Options {
+	public:
+		// Calibration, as recorded by the firmware.
+		float cool_lag = 20'000;
+		float heat_lag = 10'000;
+		float lag_degrees = 15;
+		float loss_rate = 0.007;
+		float ambient = 25;
+
+		// Paste constraints.
+		float max_ramp = 3;
+		float soak_low = 150;
+		float soak_high = 200;
+		float soak_min = 60;
+		float soak_max = 120;
+		float peak_min = 235;
+		float peak_max = 250;
+		float liquidus = 217;
+		float tal_min = 30;
+		float tal_max = 90;
+
+		int jobs = 8;
+		// data/ is where 'make uploadfs' takes the filesystem from.
+		const char *out = "data/PROFILE";
+};
+
+class Candidate {
+	public:
+		int preheat_temp, soak_temp, soak_duration, reflow_temp, reflow_duration;
+};
+
+class Result {
+	public:
+		int index = -1;
+		unsigned long cycle_time = 0;
+		unsigned long preheat_time = 0;
+		unsigned long cool_time = 0;
+};
+
+bool parse_options(int argc, char **argv, Options& options) {
+	OptionParser parser;
+	parser.add("cool-lag", &options.cool_lag);
+	parser.add("heat-lag", &options.heat_lag);
+	parser.add("lag-degrees", &options.lag_degrees);
+	parser.add("loss-rate", &options.loss_rate);
+	parser.add("ambient", &options.ambient);
+	parser.add("max-ramp", &options.max_ramp);
+	parser.add("soak-low", &options.soak_low);
+	parser.add("soak-high", &options.soak_high);
+	parser.add("soak-min", &options.soak_min);
+	parser.add("soak-max", &options.soak_max);
+	parser.add("peak-min", &options.peak_min);
+	parser.add("peak-max", &options.peak_max);
+	parser.add("liquidus", &options.liquidus);
+	parser.add("tal-min", &options.tal_min);
+	parser.add("tal-max", &options.tal_max);
+	parser.add("jobs", &options.jobs);
+	parser.add("out", &options.out);
+	return parser.parse(argc, argv);
+}
+
+std::vector<Candidate> get_candidates(const Options& options) {
+	std::vector<Candidate> candidates;
+	for (int preheat = 130; preheat <= 170; preheat += 10)
+	for (int soak = preheat + 10; soak <= 200; soak += 10)
+	for (int soak_time = 20'000; soak_time <= 120'000; soak_time += 10'000)
+	for (int peak = (int) options.peak_min; peak <= options.peak_max; peak += 5)
+	for (int reflow_time = 10'000; reflow_time <= 90'000; reflow_time += 10'000) {
+		candidates.push_back(Candidate{ preheat, soak, soak_time, peak, reflow_time });
+	}
+	return candidates;
+}
+
+/**
+ * Bakes one candidate through the firmware. Returns a result with a zero
+ * cycle time if the bake broke any of the paste's constraints.
+ */
+Result evaluate(const Options& options, const ThermalModel& model, const Candidate& candidate) {
+	preheat_temp = candidate.preheat_temp;
+	soak_temp = candidate.soak_temp;
+	soak_duration = candidate.soak_duration;
+	reflow_temp = candidate.reflow_temp;
+	reflow_duration = candidate.reflow_duration;
+	// Every candidate bakes against the calibration alone.
+	model_adapted = false;
+
+	change_state(MAIN_MENU);
+	next_state = MAIN_MENU;
+
+	ThermalSimulation sim(model, options.ambient);
+	host_time = 0;
+	host_temperature = sim.temp;
+	current_temp = last_temp = -1;
+	batch_runs = 1;
+	batch_runs_done = 0;
+
+	float peak = sim.temp;
+	float last = sim.temp;
+	float max_ramp = 0;
+	unsigned long soak_time = 0;
+	unsigned long time_above_liquidus = 0;
+	unsigned long preheat_time = 0;
+	unsigned long peak_time = 0;
+	unsigned long last_time = 0;
+
+	bool finished = firmware_run(sim, BAKE, 20 * 60'000, [&](const ThermalSimulation& s) {
+		unsigned long dt = s.time - last_time;
+		if (dt == 0) return;
+
+		float ramp = (s.temp - last) / (dt / 1000.0f);
+		if (ramp > max_ramp) max_ramp = ramp;
+		if (s.temp > peak) {
+			peak = s.temp;
+			peak_time = s.time;
+		}
+		if (s.temp >= options.liquidus) time_above_liquidus += dt;
+		if (s.temp >= options.soak_low && s.temp < options.soak_high && peak < options.soak_high) {
+			soak_time += dt;
+		}
+		if (preheat_time == 0 && reflow_state != PREHEAT) preheat_time = s.time;
+
+		last = s.temp;
+		last_time = s.time;
+	});
+
+	Result result;
+	if (!finished
+			|| max_ramp > options.max_ramp
+			|| peak < options.peak_min || peak > options.peak_max
+			|| soak_time < options.soak_min * 1000 || soak_time > options.soak_max * 1000
+			|| time_above_liquidus < options.tal_min * 1000
+			|| time_above_liquidus > options.tal_max * 1000) {
+		return result;
+	}
+
+	result.cycle_time = last_time;
+	result.preheat_time = preheat_time;
+	result.cool_time = last_time - peak_time;
+	return result;
+}
+
+/**
+ * Creates every directory leading up to path, as mkdir -p would.
+ */
+bool make_parent_dirs(const char *path) {
+	std::string dir = path;
+	for (size_t slash = dir.find('/', 1); slash != std::string::npos; slash = dir.find('/', slash + 1)) {
+		std::string parent = dir.substr(0, slash);
+		if (mkdir(parent.c_str(), 0777) != 0 && errno != EEXIST) {
+			perror(parent.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		return 1;
+	}
+	// Before the search, so that a bad path doesn't waste it.
+	if (!make_parent_dirs(options.out)) {
+		return 1;
+	}
+
+	ThermalModel model = ThermalModel::from_calibration(
+			options.cool_lag,
+			options.heat_lag,
+			options.lag_degrees,
+			options.loss_rate,
+			options.ambient);
+	firmware_boot(model, options.lag_degrees, options.ambient);
+
+	std::vector<Candidate> candidates = get_candidates(options);
+	fprintf(stderr, "Searching %zu profiles with %d jobs...\n", candidates.size(), options.jobs);
+
+	std::vector<Result> results(candidates.size());
+	bool all_ok = run_jobs(options.jobs, candidates.size(), results.data(), [&](size_t i) {
+		return evaluate(options, model, candidates[i]);
+	});
+	if (!all_ok) {
+		fprintf(stderr, "A job failed.\n");
+		return 1;
+	}
+
+	Result best;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].cycle_time == 0) continue;
+		if (best.index == -1 || results[i].cycle_time < best.cycle_time) {
+			best = results[i];
+			best.index = i;
+		}
+	}
+
+	if (best.index == -1) {
+		fprintf(stderr, "No feasible profile found.\n");
+		return 1;
+	}
+
+	const Candidate& c = candidates[best.index];
+	printf("Cycle time %s: preheat %dC, soak %dC for %ds, reflow %dC for %ds\n",
+			get_time_string(best.cycle_time).c_str(),
+			c.preheat_temp,
+			c.soak_temp, c.soak_duration / 1000,
+			c.reflow_temp, c.reflow_duration / 1000);
+
+	FILE *out = fopen(options.out, "w");
+	if (out == nullptr) {
+		perror(options.out);
+		return 1;
+	}
+	// Same order as load_profile() in the firmware.
+	fprintf(out, "%d\n%lu\n%d\n%d\n%d\n%d\n%lu\n",
+			c.preheat_temp, best.preheat_time,
+			c.soak_temp, c.soak_duration,
+			c.reflow_temp, c.reflow_duration,
+			best.cool_time);
+	fclose(out);
+	return 0;
+}
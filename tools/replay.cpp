@@ -0,0 +1,233 @@
+/**
+ * Replays recorded temperature traces through the firmware and checks that
+ * it still makes the same decisions.
+ *
+ * A trace is a CSV of "time_ms,temperature" samples, with an empty or nan
+ * temperature for a failed reading. A leading comment sets up the run:
+ *
+ *     # state=bake cool_lag=20000 heat_lag=10000 lag_degrees=15
+ *
+ * where state is bake or calibrate. The firmware is driven with a virtual
+ * clock, seeing whichever sample was most recent, and every change of the
+ * elements is recorded. The resulting timeline is compared against
+ * <trace>.expected, or written there with --update.
+ *
+ * Traces are streamed, so memory use doesn't depend on their length, and
+ * several are replayed at once in separate processes.
+ *
+ * Usage: replay [--jobs=N] [--update] trace.csv...
+ */
+
+#include "host/firmware.h"
+#include "host/jobs.h"
+#include "host/options.h"
+
+#include <vector>
+
+enum ReplayResult {
+	REPLAY_MATCH,
+	REPLAY_MISMATCH,
+	REPLAY_ERROR
+};
+
+class TraceReader {
+	public:
+		FILE *file;
+		unsigned long next_time = 0;
+		double next_temp = NAN;
+		bool has_next = false;
+
+		bool open(const char *path) {
+			file = fopen(path, "r");
+			return file != nullptr;
+		}
+
+		/**
+		 * Reads the header comment, if there is one, and the first sample.
+		 */
+		void read_header(char *header, size_t size) {
+			header[0] = '\0';
+			int c = fgetc(file);
+			ungetc(c, file);
+			if (c == '#' && fgets(header, size, file) == nullptr) {
+				header[0] = '\0';
+			}
+			advance();
+		}
+
+		void advance() {
+			char line[128];
+			has_next = false;
+			while (fgets(line, sizeof(line), file) != nullptr) {
+				char *comma = strchr(line, ',');
+				if (line[0] == '#' || comma == nullptr) continue;
+
+				char *end;
+				next_time = strtoul(line, &end, 10);
+				if (end == line) continue;
+				next_temp = strtod(comma + 1, &end);
+				if (end == comma + 1) next_temp = NAN;
+				has_next = true;
+				return;
+			}
+		}
+};
+
+/**
+ * Streams the timeline either out to the expectation file, or compares it
+ * against the existing one line by line.
+ */
+class TimelineChecker {
+	public:
+		FILE *file = nullptr;
+		bool update = false;
+		bool matched = true;
+		unsigned long first_mismatch = 0;
+
+		bool open(const string& path, bool update_expected) {
+			update = update_expected;
+			file = fopen(path.c_str(), update ? "w" : "r");
+			return file != nullptr;
+		}
+
+		void record(const char *line, unsigned long time) {
+			if (update) {
+				fputs(line, file);
+				return;
+			}
+
+			char expected[64];
+			if (matched && (fgets(expected, sizeof(expected), file) == nullptr || strcmp(expected, line) != 0)) {
+				matched = false;
+				first_mismatch = time;
+			}
+		}
+
+		void finish() {
+			char extra[64];
+			if (!update && matched && fgets(extra, sizeof(extra), file) != nullptr) {
+				matched = false;
+				first_mismatch = host_time;
+			}
+			fclose(file);
+		}
+};
+
+bool get_option(const char *header, const char *name, long *value) {
+	const char *found = strstr(header, name);
+	if (found == nullptr || found[strlen(name)] != '=') return false;
+	*value = strtol(found + strlen(name) + 1, nullptr, 10);
+	return true;
+}
+
+bool is_replaying(State start_state) {
+	if (start_state == BAKE) {
+		return current_state == BAKE;
+	}
+	return current_state == CALIBRATE_1 || current_state == CALIBRATE_2 || current_state == CALIBRATE_3;
+}
+
+ReplayResult replay(const char *path, bool update) {
+	TraceReader trace;
+	if (!trace.open(path)) {
+		perror(path);
+		return REPLAY_ERROR;
+	}
+
+	char header[256];
+	trace.read_header(header, sizeof(header));
+	if (!trace.has_next) {
+		fprintf(stderr, "%s: no samples\n", path);
+		return REPLAY_ERROR;
+	}
+
+	State start_state = strstr(header, "state=calibrate") ? CALIBRATE_1 : BAKE;
+	long cool_lag = 20'000, heat_lag = 10'000, lag_degrees = 15;
+	get_option(header, "cool_lag", &cool_lag);
+	get_option(header, "heat_lag", &heat_lag);
+	get_option(header, "lag_degrees", &lag_degrees);
+
+	TimelineChecker checker;
+	string expected_path = string(path) + ".expected";
+	if (!checker.open(expected_path, update)) {
+		perror(expected_path.c_str());
+		return REPLAY_ERROR;
+	}
+
+	ThermalModel model;
+	model.cool_lag_time = cool_lag;
+	model.heat_lag_time = heat_lag;
+	firmware_boot(model, lag_degrees, trace.next_temp);
+
+	// Start the clock at the first sample, and enter the state under test.
+	host_time = trace.next_time;
+	last_tick_time = host_time - TICK_MS;
+	next_state = start_state;
+
+	double temp = NAN;
+	bool entered = false;
+	int elements = -1;
+	char line[64];
+	while (true) {
+		while (trace.has_next && trace.next_time <= host_time) {
+			temp = trace.next_temp;
+			trace.advance();
+		}
+		if (!trace.has_next && host_time > trace.next_time) break;
+		host_temperature = temp;
+
+		loop();
+
+		if (is_replaying(start_state)) entered = true;
+		else if (entered) break;
+
+		int now_on = host_pins[TOP_ELEMENT] || host_pins[BOTTOM_ELEMENT];
+		if (now_on != elements) {
+			elements = now_on;
+			snprintf(line, sizeof(line), "%lu,%d\n", host_time, elements);
+			checker.record(line, host_time);
+		}
+	}
+
+	snprintf(line, sizeof(line), "end,%lu,%d\n", host_time, current_state);
+	checker.record(line, host_time);
+	checker.finish();
+	fclose(trace.file);
+
+	if (!checker.matched) {
+		fprintf(stderr, "%s: differs from %s from %lums\n", path, expected_path.c_str(), checker.first_mismatch);
+		return REPLAY_MISMATCH;
+	}
+	return REPLAY_MATCH;
+}
+
+int main(int argc, char **argv) {
+	int jobs = 8;
+	bool update = false;
+	std::vector<const char *> paths;
+	OptionParser parser;
+	parser.add("jobs", &jobs);
+	parser.add_flag("update", &update);
+	if (!parser.parse(argc, argv, &paths)) {
+		return 1;
+	}
+
+	// Each trace gets a freshly booted firmware in its own process. One
+	// that dies stays counted as failed.
+	std::vector<ReplayResult> results(paths.size(), REPLAY_ERROR);
+	run_jobs(jobs, paths.size(), results.data(), [&](size_t i) {
+		return replay(paths[i], update);
+	}, true);
+
+	int counts[3] = {0};
+	for (ReplayResult result : results) {
+		counts[result]++;
+	}
+
+	printf("%zu traces: %d matched, %d differed, %d failed\n",
+			paths.size(),
+			counts[REPLAY_MATCH],
+			counts[REPLAY_MISMATCH],
+			counts[REPLAY_ERROR]);
+	return counts[REPLAY_MATCH] == (int) paths.size() ? 0 : 1;
+}